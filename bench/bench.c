@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  bench.c
+ *  lua-thumbnailer
+ *
+ *  benchmark driver that runs the lua scripts with the timing functions.
+ *
+ *  build:
+ *    cc -O2 -o bench/bench bench/bench.c -llua5.1 -lm
+ *  run (the thumbnailer module must be in package.cpath):
+ *    ./bench/bench bench/bench.lua [options]
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#define PIXELS_MT   "bench.pixels"
+
+typedef struct {
+    uint32_t *data;
+    int w;
+    int h;
+} pixels_t;
+
+
+// monotonic clock in seconds
+static int now_lua( lua_State *L )
+{
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    lua_pushnumber( L, (lua_Number)ts.tv_sec + 
+                       (lua_Number)ts.tv_nsec / 1000000000.0 );
+    
+    return 1;
+}
+
+
+// peak resident set size in kilobytes
+static int maxrss_lua( lua_State *L )
+{
+    struct rusage ru;
+    
+    getrusage( RUSAGE_SELF, &ru );
+#ifdef __APPLE__
+    lua_pushnumber( L, (lua_Number)ru.ru_maxrss / 1024 );
+#else
+    lua_pushnumber( L, (lua_Number)ru.ru_maxrss );
+#endif
+    
+    return 1;
+}
+
+
+// generate the synthetic image that has gradients, edges and noise.
+static int synth_lua( lua_State *L )
+{
+    int w = luaL_checkint( L, 1 );
+    int h = luaL_checkint( L, 2 );
+    int alpha = lua_toboolean( L, 3 );
+    uint32_t seed = (uint32_t)luaL_optinteger( L, 4, 1 );
+    pixels_t *px = NULL;
+    uint32_t *p = NULL;
+    int x, y;
+    
+    luaL_argcheck( L, w > 0, 1, "width must be larger than 0" );
+    luaL_argcheck( L, h > 0, 2, "height must be larger than 0" );
+    px = (pixels_t*)lua_newuserdata( L, sizeof( pixels_t ) );
+    px->w = w;
+    px->h = h;
+    if( !( px->data = malloc( sizeof( uint32_t ) * (size_t)w * (size_t)h ) ) ){
+        return luaL_error( L, "failed to allocate %dx%d pixels", w, h );
+    }
+    luaL_getmetatable( L, PIXELS_MT );
+    lua_setmetatable( L, -2 );
+    
+    p = px->data;
+    for( y = 0; y < h; y++ )
+    {
+        for( x = 0; x < w; x++ )
+        {
+            uint32_t r = (uint32_t)( (int64_t)x * 255 / w );
+            uint32_t g = (uint32_t)( (int64_t)y * 255 / h );
+            uint32_t b = ( ( x >> 5 ) ^ ( y >> 5 ) ) & 1 ? 0xe0 : 0x20;
+            uint32_t a = alpha ? (uint32_t)( ( x + y ) & 0xff ) : 0xff;
+            
+            seed = seed * 1103515245 + 12345;
+            b ^= ( seed >> 16 ) & 0x1f;
+            *p++ = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+    
+    return 1;
+}
+
+
+static int pixels_ptr_lua( lua_State *L )
+{
+    pixels_t *px = (pixels_t*)luaL_checkudata( L, 1, PIXELS_MT );
+    
+    lua_pushlightuserdata( L, px->data );
+    
+    return 1;
+}
+
+
+static int pixels_gc( lua_State *L )
+{
+    pixels_t *px = (pixels_t*)luaL_checkudata( L, 1, PIXELS_MT );
+    
+    free( px->data );
+    px->data = NULL;
+    
+    return 0;
+}
+
+
+static int traceback( lua_State *L )
+{
+    lua_getfield( L, LUA_GLOBALSINDEX, "debug" );
+    lua_getfield( L, -1, "traceback" );
+    lua_pushvalue( L, 1 );
+    lua_pushinteger( L, 2 );
+    lua_call( L, 2, 1 );
+    
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    lua_State *L = NULL;
+    int i = 2;
+    int rc = EXIT_SUCCESS;
+    
+    if( argc < 2 ){
+        fprintf( stderr, "usage: %s script.lua [options]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    else if( !( L = luaL_newstate() ) ){
+        fprintf( stderr, "failed to create lua state\n" );
+        return EXIT_FAILURE;
+    }
+    luaL_openlibs( L );
+    
+    // pixels metatable
+    luaL_newmetatable( L, PIXELS_MT );
+    lua_pushcfunction( L, pixels_gc );
+    lua_setfield( L, -2, "__gc" );
+    lua_newtable( L );
+    lua_pushcfunction( L, pixels_ptr_lua );
+    lua_setfield( L, -2, "ptr" );
+    lua_setfield( L, -2, "__index" );
+    lua_pop( L, 1 );
+    
+    // bench functions
+    lua_newtable( L );
+    lua_pushcfunction( L, now_lua );
+    lua_setfield( L, -2, "now" );
+    lua_pushcfunction( L, maxrss_lua );
+    lua_setfield( L, -2, "maxrss" );
+    lua_pushcfunction( L, synth_lua );
+    lua_setfield( L, -2, "synth" );
+    lua_setglobal( L, "bench" );
+    
+    // script arguments
+    lua_newtable( L );
+    for(; i < argc; i++ ){
+        lua_pushstring( L, argv[i] );
+        lua_rawseti( L, -2, i - 1 );
+    }
+    lua_setglobal( L, "arg" );
+    
+    lua_pushcfunction( L, traceback );
+    if( luaL_loadfile( L, argv[1] ) != 0 || 
+        lua_pcall( L, 0, 0, -2 ) != 0 ){
+        fprintf( stderr, "%s\n", lua_tostring( L, -1 ) );
+        rc = EXIT_FAILURE;
+    }
+    lua_close( L );
+    
+    return rc;
+}
@@ -0,0 +1,247 @@
+--[[
+    benchmark of load, read and every save mode.
+    run by the driver: ./bench/bench bench/bench.lua [options]
+    
+    options:
+        --sizes=0.3,1,4,12,24,50,100   image sizes in megapixels
+        --aspects=4:3,16:9,1:1         aspect ratios of images
+        --alpha=no,yes                 generate images with/without alpha
+        --formats=jpg,png              output formats
+        --qualities=50,80,95           output qualities
+        --filters=imlib                resample filters
+        --threads=1                    number of threads to scale an image
+        --thumb=200x200                size of thumbnails
+        --time=1                       min seconds of each case
+        --iter=5                       min iterations of each case
+    
+    each result is printed as a JSON line.
+--]]
+local thumbnailer = require('thumbnailer');
+local OPTS = {
+    sizes = '0.3,1,4,12,24,50,100',
+    aspects = '4:3,16:9,1:1',
+    alpha = 'no,yes',
+    formats = 'jpg,png',
+    qualities = '50,80,95',
+    filters = 'imlib',
+    threads = '1',
+    thumb = '200x200',
+    time = '1',
+    iter = '5'
+};
+local SAVE_MODES = { 'save', 'saveCrop', 'saveTrim', 'saveAspect' };
+
+
+local function split( str )
+    local list = {};
+    
+    for v in string.gmatch( str, '[^,]+' ) do
+        list[#list + 1] = v;
+    end
+    
+    return list;
+end
+
+
+local function encode( val )
+    local t = type( val );
+    
+    if t == 'number' then
+        return string.format( '%.6g', val );
+    elseif t == 'boolean' then
+        return tostring( val );
+    elseif t == 'string' then
+        return string.format( '%q', val );
+    end
+    
+    local keys = {};
+    local fields = {};
+    
+    for k in pairs( val ) do
+        keys[#keys + 1] = k;
+    end
+    table.sort( keys );
+    for _, k in ipairs( keys ) do
+        fields[#fields + 1] = string.format( '%q:%s', k, encode( val[k] ) );
+    end
+    
+    return '{' .. table.concat( fields, ',' ) .. '}';
+end
+
+
+-- nearest-rank percentile of sorted samples
+local function percentile( samples, p )
+    local idx = math.ceil( p * #samples );
+    
+    return samples[idx < 1 and 1 or idx];
+end
+
+
+-- call fn until both of min iterations and min seconds are elapsed
+local function measure( result, fn )
+    local samples = {};
+    local total = 0;
+    
+    repeat
+        local t = bench.now();
+        local err = fn();
+        
+        t = bench.now() - t;
+        if err then
+            result.err = err;
+            break;
+        end
+        samples[#samples + 1] = t;
+        total = total + t;
+    until #samples >= OPTS.iter and total >= OPTS.time;
+    
+    if #samples > 0 then
+        table.sort( samples );
+        result.iter = #samples;
+        result.mean_ms = total / #samples * 1000;
+        result.p50_ms = percentile( samples, 0.5 ) * 1000;
+        result.p99_ms = percentile( samples, 0.99 ) * 1000;
+        -- throughput of source pixels
+        result.mps = result.mp / ( total / #samples );
+    end
+    result.maxrss_kb = bench.maxrss();
+    print( encode( result ) );
+    io.stdout:flush();
+end
+
+
+local function newresult( op, cfg )
+    local result = { op = op };
+    
+    for k, v in pairs( cfg ) do
+        result[k] = v;
+    end
+    
+    return result;
+end
+
+
+local function bench_load( cfg, pixels, tmpfile )
+    measure( newresult( 'read', cfg ), function()
+        local img, err = thumbnailer.read( cfg.w, cfg.h, pixels:ptr() );
+        
+        if err then
+            return err;
+        end
+        img:free();
+    end);
+    
+    for _, format in ipairs( split( OPTS.formats ) ) do
+        local img, err = thumbnailer.read( cfg.w, cfg.h, pixels:ptr() );
+        local path = tmpfile .. '-src.' .. format;
+        local result = newresult( 'load', cfg );
+        
+        result.format = format;
+        if img then
+            img:size( cfg.w, cfg.h );
+            img:format( format );
+            img:quality( 90 );
+            err = img:save( path );
+            img:free();
+        end
+        
+        if err then
+            result.err = err;
+            print( encode( result ) );
+        else
+            measure( result, function()
+                local img, err = thumbnailer.load( path );
+                
+                if err then
+                    return err;
+                end
+                img:free();
+            end);
+        end
+        os.remove( path );
+    end
+end
+
+
+local function bench_save( cfg, pixels, tmpfile )
+    local tw, th = string.match( OPTS.thumb, '^(%d+)x(%d+)$' );
+    local img, err = thumbnailer.read( cfg.w, cfg.h, pixels:ptr() );
+    
+    if err then
+        print( encode( newresult( 'save', { err = err } ) ) );
+        return;
+    end
+    img:size( tonumber( tw ), tonumber( th ) );
+    
+    for _, filter in ipairs( split( OPTS.filters ) ) do
+        img:filter( filter );
+        for _, format in ipairs( split( OPTS.formats ) ) do
+            local path = tmpfile .. '-dst.' .. format;
+            
+            img:format( format );
+            for _, quality in ipairs( split( OPTS.qualities ) ) do
+                img:quality( tonumber( quality ) );
+                for _, mode in ipairs( SAVE_MODES ) do
+                    local result = newresult( mode, cfg );
+                    
+                    result.filter = filter;
+                    result.format = format;
+                    result.quality = tonumber( quality );
+                    result.thumb = OPTS.thumb;
+                    measure( result, function()
+                        return img[mode]( img, path );
+                    end);
+                end
+            end
+            os.remove( path );
+        end
+    end
+    img:free();
+end
+
+
+local function main()
+    local tmpfile = os.tmpname();
+    
+    for _, v in ipairs( arg ) do
+        local k, opt = string.match( v, '^%-%-([%w_]+)=(.*)$' );
+        
+        if not k or not OPTS[k] then
+            error( 'unknown option: ' .. v );
+        end
+        OPTS[k] = opt;
+    end
+    OPTS.iter = tonumber( OPTS.iter );
+    OPTS.time = tonumber( OPTS.time );
+    thumbnailer.threads( tonumber( OPTS.threads ) );
+    
+    for _, size in ipairs( split( OPTS.sizes ) ) do
+        for _, aspect in ipairs( split( OPTS.aspects ) ) do
+            local aw, ah = string.match( aspect, '^(%d+):(%d+)$' );
+            local mp = tonumber( size );
+            -- width and height of the size and aspect ratio
+            local h = math.floor( math.sqrt( mp * 1e6 * ah / aw ) + 0.5 );
+            local w = math.floor( mp * 1e6 / h + 0.5 );
+            
+            for _, alpha in ipairs( split( OPTS.alpha ) ) do
+                local cfg = {
+                    w = w,
+                    h = h,
+                    mp = w * h / 1e6,
+                    aspect = aspect,
+                    alpha = alpha == 'yes',
+                    threads = tonumber( OPTS.threads )
+                };
+                local pixels = bench.synth( w, h, cfg.alpha );
+                
+                bench_load( cfg, pixels, tmpfile );
+                bench_save( cfg, pixels, tmpfile );
+                pixels = nil;
+                collectgarbage('collect');
+            end
+        end
+    end
+    os.remove( tmpfile );
+end
+
+main();
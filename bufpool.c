@@ -0,0 +1,216 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  bufpool.c
+ *  lua-thumbnailer
+ *
+ *  size-class pool of the large pixel buffers.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "bufpool.h"
+
+// buffers smaller than 64KB are not pooled
+#define BUFPOOL_MIN_SHIFT   16
+#define BUFPOOL_MAX_SHIFT   31
+// number of the size classes per power of two. a buffer wastes at most 
+// 25% of the requested size.
+#define BUFPOOL_STEPS       4
+#define BUFPOOL_NCLASS      \
+    ( ( BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT ) * BUFPOOL_STEPS )
+#define BUFPOOL_DEFAULT     ( 64 * 1024 * 1024 )
+
+// idle buffer holds the link to the next idle buffer of the same class
+typedef struct node_s {
+    struct node_s *next;
+} node_t;
+
+
+static pthread_mutex_t MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static node_t *IDLE[BUFPOOL_NCLASS];
+static bufpool_stats_t STATS = {
+    .capacity = BUFPOOL_DEFAULT
+};
+
+
+// returns the size class of size, or -1 if size is not pooled
+static int size_class( size_t size, size_t *csize )
+{
+    int shift = 0;
+    size_t step = 0;
+    
+    if( size < ( (size_t)1 << BUFPOOL_MIN_SHIFT ) || 
+        size > ( (size_t)1 << ( BUFPOOL_MAX_SHIFT - 1 ) ) * 2 - 
+               ( (size_t)1 << ( BUFPOOL_MAX_SHIFT - 3 ) ) ){
+        return -1;
+    }
+    
+    shift = 63 - __builtin_clzll( (unsigned long long)size );
+    step = (size_t)1 << ( shift - 2 );
+    *csize = ( size + step - 1 ) & ~( step - 1 );
+    
+    // size that rounded up to the next power of two is (shift + 1, 0)
+    return ( shift - BUFPOOL_MIN_SHIFT ) * BUFPOOL_STEPS + 
+           (int)( *csize >> ( shift - 2 ) ) - BUFPOOL_STEPS;
+}
+
+
+// pop the idle buffers until the idle bytes fits to the capacity.
+// MUTEX must be held. returns the list of the popped buffers.
+static node_t *shrink( size_t capacity )
+{
+    node_t *list = NULL;
+    node_t *node = NULL;
+    int i = BUFPOOL_NCLASS - 1;
+    
+    // release the larger buffers first
+    for(; i >= 0 && STATS.bytes > capacity; i-- )
+    {
+        size_t csize = (size_t)( BUFPOOL_STEPS + i % BUFPOOL_STEPS ) << 
+                       ( BUFPOOL_MIN_SHIFT + i / BUFPOOL_STEPS - 2 );
+        
+        while( IDLE[i] && STATS.bytes > capacity ){
+            node = IDLE[i];
+            IDLE[i] = node->next;
+            node->next = list;
+            list = node;
+            STATS.bytes -= csize;
+        }
+    }
+    
+    return list;
+}
+
+
+static void release_list( node_t *list )
+{
+    node_t *node = NULL;
+    
+    while( list ){
+        node = list;
+        list = list->next;
+        free( node );
+    }
+}
+
+
+void *bufpool_alloc( size_t size )
+{
+    size_t csize = 0;
+    int idx = size_class( size, &csize );
+    node_t *node = NULL;
+    
+    if( idx == -1 ){
+        if( !( node = malloc( size ) ) ){
+            errno = ENOMEM;
+        }
+        return node;
+    }
+    
+    pthread_mutex_lock( &MUTEX );
+    if( ( node = IDLE[idx] ) ){
+        IDLE[idx] = node->next;
+        STATS.bytes -= csize;
+        STATS.hits++;
+    }
+    else {
+        STATS.misses++;
+    }
+    STATS.used += csize;
+    if( STATS.used + STATS.bytes > STATS.peak ){
+        STATS.peak = STATS.used + STATS.bytes;
+    }
+    pthread_mutex_unlock( &MUTEX );
+    
+    if( node ){
+        return node;
+    }
+    // release all idle buffers and retry if out of memory
+    else if( !( node = malloc( csize ) ) )
+    {
+        pthread_mutex_lock( &MUTEX );
+        node = shrink( 0 );
+        pthread_mutex_unlock( &MUTEX );
+        release_list( node );
+        if( !( node = malloc( csize ) ) ){
+            pthread_mutex_lock( &MUTEX );
+            STATS.used -= csize;
+            pthread_mutex_unlock( &MUTEX );
+            errno = ENOMEM;
+        }
+    }
+    
+    return node;
+}
+
+
+void bufpool_free( void *ptr, size_t size )
+{
+    size_t csize = 0;
+    int idx = size_class( size, &csize );
+    node_t *node = (node_t*)ptr;
+    
+    if( !ptr ){
+        return;
+    }
+    else if( idx != -1 )
+    {
+        pthread_mutex_lock( &MUTEX );
+        STATS.used -= csize;
+        if( STATS.bytes + csize <= STATS.capacity ){
+            node->next = IDLE[idx];
+            IDLE[idx] = node;
+            STATS.bytes += csize;
+            node = NULL;
+        }
+        pthread_mutex_unlock( &MUTEX );
+    }
+    free( node );
+}
+
+
+void bufpool_resize( size_t capacity )
+{
+    node_t *list = NULL;
+    
+    pthread_mutex_lock( &MUTEX );
+    STATS.capacity = capacity;
+    list = shrink( capacity );
+    pthread_mutex_unlock( &MUTEX );
+    release_list( list );
+}
+
+
+void bufpool_stats( bufpool_stats_t *stats, int reset )
+{
+    pthread_mutex_lock( &MUTEX );
+    *stats = STATS;
+    if( reset ){
+        STATS.hits = 0;
+        STATS.misses = 0;
+        STATS.peak = STATS.used + STATS.bytes;
+    }
+    pthread_mutex_unlock( &MUTEX );
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  bufpool.h
+ *  lua-thumbnailer
+ *
+ *  size-class pool of the large pixel buffers.
+ *
+ */
+
+#ifndef ___THUMBNAILER_BUFPOOL_H___
+#define ___THUMBNAILER_BUFPOOL_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    // max bytes of the idle buffers kept by the pool
+    size_t capacity;
+    // bytes of the idle buffers
+    size_t bytes;
+    // bytes of the buffers in use
+    size_t used;
+    // high-water mark of used + bytes
+    size_t peak;
+    uint64_t hits;
+    uint64_t misses;
+} bufpool_stats_t;
+
+
+// returns the buffer of size bytes, or NULL on failure with errno. 
+// the small buffers are allocated by malloc directly.
+void *bufpool_alloc( size_t size );
+
+// return the buffer that allocated by bufpool_alloc with the same size
+void bufpool_free( void *ptr, size_t size );
+
+// set the max bytes of the idle buffers and release the exceeded buffers.
+// 0 disables the pool.
+void bufpool_resize( size_t capacity );
+
+// reset clears the hits and misses, and sets the peak to the current bytes
+void bufpool_stats( bufpool_stats_t *stats, int reset );
+
+
+#endif
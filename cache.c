@@ -0,0 +1,297 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  cache.c
+ *  lua-thumbnailer
+ *
+ *  size-bounded LRU cache of reference counted values.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "cache.h"
+
+#define CACHE_MIN_BUCKETS   64
+
+typedef struct entry_s entry_t;
+
+struct entry_s {
+    // hash chain
+    entry_t *next;
+    // LRU list. head is the most recently used
+    entry_t *prev_lru;
+    entry_t *next_lru;
+    uint64_t hash;
+    void *val;
+    size_t bytes;
+    char key[];
+};
+
+
+struct cache_s {
+    pthread_mutex_t mutex;
+    const cache_ops_t *ops;
+    entry_t **buckets;
+    size_t nbucket;
+    entry_t *head;
+    entry_t *tail;
+    cache_stats_t stats;
+};
+
+
+// FNV-1a
+static uint64_t key_hash( const char *key )
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    
+    for(; *key; key++ ){
+        h = ( h ^ (uint8_t)*key ) * 0x100000001b3ULL;
+    }
+    
+    return h;
+}
+
+
+cache_t *cache_new( const cache_ops_t *ops )
+{
+    cache_t *c = calloc( 1, sizeof( cache_t ) );
+    
+    if( !c ){
+        errno = ENOMEM;
+        return NULL;
+    }
+    else if( !( c->buckets = calloc( CACHE_MIN_BUCKETS, 
+                                     sizeof( entry_t* ) ) ) ){
+        free( c );
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_init( &c->mutex, NULL );
+    c->ops = ops;
+    c->nbucket = CACHE_MIN_BUCKETS;
+    
+    return c;
+}
+
+
+static inline void lru_unlink( cache_t *c, entry_t *e )
+{
+    if( e->prev_lru ){
+        e->prev_lru->next_lru = e->next_lru;
+    }
+    else {
+        c->head = e->next_lru;
+    }
+    if( e->next_lru ){
+        e->next_lru->prev_lru = e->prev_lru;
+    }
+    else {
+        c->tail = e->prev_lru;
+    }
+    e->prev_lru = e->next_lru = NULL;
+}
+
+
+static inline void lru_push( cache_t *c, entry_t *e )
+{
+    e->prev_lru = NULL;
+    e->next_lru = c->head;
+    if( c->head ){
+        c->head->prev_lru = e;
+    }
+    else {
+        c->tail = e;
+    }
+    c->head = e;
+}
+
+
+static entry_t **entry_ref( cache_t *c, const char *key, uint64_t hash )
+{
+    entry_t **ref = &c->buckets[hash & ( c->nbucket - 1 )];
+    
+    for(; *ref; ref = &(*ref)->next ){
+        if( (*ref)->hash == hash && strcmp( (*ref)->key, key ) == 0 ){
+            break;
+        }
+    }
+    
+    return ref;
+}
+
+
+static void entry_remove( cache_t *c, entry_t **ref )
+{
+    entry_t *e = *ref;
+    
+    *ref = e->next;
+    lru_unlink( c, e );
+    c->stats.bytes -= e->bytes;
+    c->stats.entries--;
+    c->ops->release( e->val );
+    free( e );
+}
+
+
+static void evict( cache_t *c, size_t capacity )
+{
+    while( c->tail && c->stats.bytes > capacity ){
+        entry_t *e = c->tail;
+        
+        if( c->ops->evict ){
+            c->ops->evict( e->val );
+        }
+        entry_remove( c, entry_ref( c, e->key, e->hash ) );
+        c->stats.evictions++;
+    }
+}
+
+
+// double the buckets if there are more entries than buckets
+static void rehash( cache_t *c )
+{
+    size_t nbucket = c->nbucket * 2;
+    entry_t **buckets = NULL;
+    size_t i = 0;
+    
+    if( c->stats.entries < c->nbucket || 
+        !( buckets = calloc( nbucket, sizeof( entry_t* ) ) ) ){
+        return;
+    }
+    for(; i < c->nbucket; i++ )
+    {
+        entry_t *e = c->buckets[i];
+        
+        while( e ){
+            entry_t *next = e->next;
+            
+            e->next = buckets[e->hash & ( nbucket - 1 )];
+            buckets[e->hash & ( nbucket - 1 )] = e;
+            e = next;
+        }
+    }
+    free( c->buckets );
+    c->buckets = buckets;
+    c->nbucket = nbucket;
+}
+
+
+void cache_resize( cache_t *c, size_t capacity )
+{
+    pthread_mutex_lock( &c->mutex );
+    c->stats.capacity = capacity;
+    evict( c, capacity );
+    pthread_mutex_unlock( &c->mutex );
+}
+
+
+void cache_free( cache_t *c )
+{
+    while( c->tail ){
+        entry_remove( c, entry_ref( c, c->tail->key, c->tail->hash ) );
+    }
+    pthread_mutex_destroy( &c->mutex );
+    free( c->buckets );
+    free( c );
+}
+
+
+void *cache_get( cache_t *c, const char *key )
+{
+    uint64_t hash = key_hash( key );
+    entry_t *e = NULL;
+    void *val = NULL;
+    
+    pthread_mutex_lock( &c->mutex );
+    if( ( e = *entry_ref( c, key, hash ) ) ){
+        lru_unlink( c, e );
+        lru_push( c, e );
+        val = e->val;
+        c->ops->retain( val );
+        c->stats.hits++;
+    }
+    else {
+        c->stats.misses++;
+    }
+    pthread_mutex_unlock( &c->mutex );
+    
+    return val;
+}
+
+
+int cache_put( cache_t *c, const char *key, void *val, size_t bytes )
+{
+    uint64_t hash = key_hash( key );
+    size_t len = strlen( key ) + 1;
+    entry_t **ref = NULL;
+    entry_t *e = NULL;
+    
+    pthread_mutex_lock( &c->mutex );
+    if( bytes > c->stats.capacity ){
+        pthread_mutex_unlock( &c->mutex );
+        errno = E2BIG;
+        return -1;
+    }
+    else if( !( e = malloc( sizeof( entry_t ) + len ) ) ){
+        pthread_mutex_unlock( &c->mutex );
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    // replace the value of the same key
+    if( *( ref = entry_ref( c, key, hash ) ) ){
+        entry_remove( c, ref );
+    }
+    evict( c, c->stats.capacity - bytes );
+    
+    memcpy( e->key, key, len );
+    e->hash = hash;
+    e->val = val;
+    e->bytes = bytes;
+    c->ops->retain( val );
+    ref = &c->buckets[hash & ( c->nbucket - 1 )];
+    e->next = *ref;
+    *ref = e;
+    lru_push( c, e );
+    c->stats.bytes += bytes;
+    c->stats.entries++;
+    rehash( c );
+    pthread_mutex_unlock( &c->mutex );
+    
+    return 0;
+}
+
+
+void cache_stats( cache_t *c, cache_stats_t *stats, int reset )
+{
+    pthread_mutex_lock( &c->mutex );
+    *stats = c->stats;
+    if( reset ){
+        c->stats.hits = 0;
+        c->stats.misses = 0;
+        c->stats.evictions = 0;
+    }
+    pthread_mutex_unlock( &c->mutex );
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  cache.h
+ *  lua-thumbnailer
+ *
+ *  size-bounded LRU cache of reference counted values.
+ *
+ */
+
+#ifndef ___THUMBNAILER_CACHE_H___
+#define ___THUMBNAILER_CACHE_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    // called while holding the cache lock
+    void (*retain)( void *val );
+    void (*release)( void *val );
+    // called before releasing the value that evicted by the capacity. 
+    // optional.
+    void (*evict)( void *val );
+} cache_ops_t;
+
+
+typedef struct {
+    size_t capacity;
+    size_t bytes;
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} cache_stats_t;
+
+
+typedef struct cache_s cache_t;
+
+
+// returns NULL on failure with errno
+cache_t *cache_new( const cache_ops_t *ops );
+
+// release all values without evicting them, and free the cache
+void cache_free( cache_t *c );
+
+// set the capacity in bytes and evict the least recently used values. 
+// 0 disables the cache and releases all values.
+void cache_resize( cache_t *c, size_t capacity );
+
+// returns the value that retained for the caller, or NULL
+void *cache_get( cache_t *c, const char *key );
+
+// add the value of bytes. the value is retained by the cache.
+// returns 0 on success, or -1 on failure with errno. the value that larger 
+// than the capacity is not added. (E2BIG)
+int cache_put( cache_t *c, const char *key, void *val, size_t bytes );
+
+void cache_stats( cache_t *c, cache_stats_t *stats, int reset );
+
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  capi.c
+ *  lua-thumbnailer
+ *
+ *  stable C ABI of the thumbnailer core for the FFI bindings.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "img.h"
+#include "resample.h"
+#include "stats.h"
+#include "thumbnailer.h"
+
+
+// release the image that failed to be created, and returns NULL
+static thumbnailer_t *img_fail( img_t *img, int op, uint64_t start, int *err )
+{
+    int errnum = errno;
+    
+    stats_op( op, NULL, start, 0, 0, errnum );
+    free( img );
+    if( err ){
+        *err = errnum;
+    }
+    
+    return NULL;
+}
+
+
+thumbnailer_t *thumbnailer_load( const char *path, int hint_w, int hint_h, 
+                                 int *err )
+{
+    codec_hint_t hint = { 
+        hint_w > 0 ? hint_w : 0, hint_h > 0 ? hint_h : 0, 0, 0, 0 
+    };
+    img_t *img = malloc( sizeof( img_t ) );
+    uint64_t start = stats_now();
+    
+    if( !img ){
+        errno = ENOMEM;
+    }
+    else if( img_load( img, path, &hint ) == 0 ){
+        stats_stage( STATS_DECODE, start );
+        stats_op( STATS_LOAD, img->format, start, 0, img->bytes, 0 );
+        return img;
+    }
+    
+    return img_fail( img, STATS_LOAD, start, err );
+}
+
+
+thumbnailer_t *thumbnailer_load_buffer( const void *data, size_t len, 
+                                        const char *format, int hint_w, 
+                                        int hint_h, int *err )
+{
+    codec_hint_t hint = { 
+        hint_w > 0 ? hint_w : 0, hint_h > 0 ? hint_h : 0, 0, 0, 0 
+    };
+    img_t *img = malloc( sizeof( img_t ) );
+    uint64_t start = stats_now();
+    
+    if( !img ){
+        errno = ENOMEM;
+    }
+    else if( img_load_buffer( img, data, len, format, &hint ) == 0 ){
+        stats_stage( STATS_DECODE, start );
+        stats_op( STATS_LOAD_BUFFER, img->format, start, len, img->bytes, 0 );
+        return img;
+    }
+    
+    return img_fail( img, STATS_LOAD_BUFFER, start, err );
+}
+
+
+thumbnailer_t *thumbnailer_read( int w, int h, const void *data, 
+                                 size_t stride, const char *pixfmt, 
+                                 int *err )
+{
+    int fmt = codec_raw_format( pixfmt ? pixfmt : "argb32" );
+    img_t *img = NULL;
+    uint64_t start = stats_now();
+    
+    if( w < 1 || h < 1 || !data || fmt < 0 || 
+        ( stride && stride < (size_t)w * (size_t)codec_raw_bpp( fmt ) ) ){
+        errno = EINVAL;
+    }
+    else if( ( img = malloc( sizeof( img_t ) ) ) && 
+             img_read( img, w, h, data, stride ? stride : 
+                       (size_t)w * (size_t)codec_raw_bpp( fmt ), fmt ) == 0 ){
+        stats_op( STATS_READ, img->format, start, img->bytes, img->bytes, 0 );
+        return img;
+    }
+    else if( !img ){
+        errno = ENOMEM;
+    }
+    
+    return img_fail( img, STATS_READ, start, err );
+}
+
+
+void thumbnailer_free( thumbnailer_t *img )
+{
+    if( img ){
+        img_dispose( img );
+        free( img );
+    }
+}
+
+
+const uint32_t *thumbnailer_pixels( thumbnailer_t *img, int *w, int *h )
+{
+    *w = img->size.w;
+    *h = img->size.h;
+    
+    return (const uint32_t*)img->blob;
+}
+
+
+void thumbnailer_origsize( thumbnailer_t *img, int *w, int *h )
+{
+    *w = img->orig.w;
+    *h = img->orig.h;
+}
+
+
+int thumbnailer_resize( thumbnailer_t *img, int w, int h )
+{
+    if( w < 0 || h < 0 ){
+        return EINVAL;
+    }
+    img->resize = (img_size_t){ w, h };
+    
+    return 0;
+}
+
+
+int thumbnailer_quality( thumbnailer_t *img, int quality )
+{
+    SETVAL_IN_RANGE( img->quality, uint8_t, quality, 0, 100 );
+    
+    return 0;
+}
+
+
+int thumbnailer_filter( thumbnailer_t *img, const char *name )
+{
+    int filter = resample_filter( name );
+    
+    if( filter == -1 ){
+        return EINVAL;
+    }
+    img->filter = (uint8_t)filter;
+    
+    return 0;
+}
+
+
+int thumbnailer_format( thumbnailer_t *img, const char *format )
+{
+    return img_format_copy( img, format, strlen( format ) ) == 0 ? 0 : EINVAL;
+}
+
+
+static int export_img( thumbnailer_t *img, img_dest_t *dest, int mode, 
+                       int halign, int valign )
+{
+    img_spec_t spec;
+    
+    if( mode < IMG_MODE_STRETCH || mode > IMG_MODE_ASPECT || 
+        ( halign && ( halign < IMG_ALIGN_LEFT || 
+                      halign > IMG_ALIGN_RIGHT ) ) || 
+        ( valign && ( valign < IMG_ALIGN_TOP || 
+                      valign > IMG_ALIGN_BOTTOM ) ) ){
+        return EINVAL;
+    }
+    else if( !img->blob ){
+        return EBADF;
+    }
+    
+    img_spec_init( &spec, img, (uint8_t)mode );
+    if( halign ){
+        spec.halign = (uint8_t)halign;
+    }
+    if( valign ){
+        spec.valign = (uint8_t)valign;
+    }
+    
+    return img_export( img, &spec, dest ) == 0 ? 0 : errno;
+}
+
+
+int thumbnailer_save( thumbnailer_t *img, const char *path, int mode, 
+                      int halign, int valign )
+{
+    img_dest_t dest = { path, -1, NULL };
+    
+    return export_img( img, &dest, mode, halign, valign );
+}
+
+
+int thumbnailer_encode( thumbnailer_t *img, int mode, int halign, 
+                        int valign, void **data, size_t *len )
+{
+    membuf_t buf;
+    img_dest_t dest = { NULL, -1, &buf };
+    int rc = 0;
+    
+    membuf_init( &buf );
+    if( ( rc = export_img( img, &dest, mode, halign, valign ) ) != 0 ){
+        membuf_dispose( &buf );
+        return rc;
+    }
+    *data = buf.data;
+    *len = buf.len;
+    
+    return 0;
+}
+
+
+void thumbnailer_release( void *data )
+{
+    free( data );
+}
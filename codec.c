@@ -0,0 +1,390 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  codec.c
+ *  lua-thumbnailer
+ *
+ *  dispatcher of native image codecs.
+ *
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "codec.h"
+#include "bufpool.h"
+
+
+int codec_is_native( const char *format )
+{
+    return strcasecmp( format, "jpg" ) == 0 || 
+           strcasecmp( format, "jpeg" ) == 0 ||
+           strcasecmp( format, "png" ) == 0 ||
+           strcasecmp( format, "webp" ) == 0;
+}
+
+
+typedef int (*encoder_t)( membuf_t *buf, codec_src_t *src );
+
+// binary search the highest quality that the output fits in max_bytes, 
+// reusing the source pixels. the output of the lowest quality is used if 
+// no quality fits.
+static int encode_max_bytes( membuf_t *buf, codec_src_t *src, 
+                             encoder_t encode )
+{
+    codec_src_t s = *src;
+    membuf_t out;
+    membuf_t fit;
+    membuf_t tmp;
+    int lo = 0;
+    int hi = src->quality;
+    int found = 0;
+    int rc = 0;
+    
+    membuf_init( &out );
+    membuf_init( &fit );
+    // try the quality first
+    if( ( rc = encode( &out, &s ) ) != 0 || out.len <= src->opts->max_bytes ){
+        found = 1;
+    }
+    else {
+        hi--;
+    }
+    while( !found && lo <= hi )
+    {
+        s.quality = (uint8_t)( ( lo + hi ) / 2 );
+        out.len = 0;
+        if( ( rc = encode( &out, &s ) ) != 0 ){
+            break;
+        }
+        else if( out.len <= src->opts->max_bytes ){
+            tmp = fit;
+            fit = out;
+            out = tmp;
+            lo = s.quality + 1;
+        }
+        else {
+            hi = s.quality - 1;
+        }
+    }
+    
+    if( rc == 0 ){
+        // out holds the output of the lowest quality if nothing fits
+        rc = fit.len ? membuf_append( buf, fit.data, fit.len ) : 
+                       membuf_append( buf, out.data, out.len );
+    }
+    membuf_dispose( &out );
+    membuf_dispose( &fit );
+    
+    return rc;
+}
+
+
+int codec_encode( membuf_t *buf, codec_src_t *src, const char *format )
+{
+    encoder_t encode = NULL;
+    int lossy = 1;
+    
+    if( strcasecmp( format, "png" ) == 0 ){
+        encode = codec_encode_png;
+        lossy = 0;
+    }
+    else if( strcasecmp( format, "jpg" ) == 0 || 
+             strcasecmp( format, "jpeg" ) == 0 ){
+        encode = codec_encode_jpeg;
+    }
+    else if( strcasecmp( format, "webp" ) == 0 ){
+        encode = codec_encode_webp;
+        lossy = !( src->opts && src->opts->lossless );
+    }
+    // unsupported format
+    else {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if( lossy && src->opts && src->opts->max_bytes ){
+        return encode_max_bytes( buf, src, encode );
+    }
+    
+    return encode( buf, src );
+}
+
+
+const char *codec_sniff( const void *data, size_t len )
+{
+    const uint8_t *p = (const uint8_t*)data;
+    
+    if( len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF ){
+        return "jpeg";
+    }
+    else if( len >= 8 && memcmp( p, "\x89PNG\r\n\x1a\n", 8 ) == 0 ){
+        return "png";
+    }
+    else if( len >= 6 && ( memcmp( p, "GIF87a", 6 ) == 0 || 
+                           memcmp( p, "GIF89a", 6 ) == 0 ) ){
+        return "gif";
+    }
+    
+    return NULL;
+}
+
+
+int codec_can_decode( const char *format )
+{
+    return strcasecmp( format, "jpg" ) == 0 || 
+           strcasecmp( format, "jpeg" ) == 0 ||
+           strcasecmp( format, "png" ) == 0;
+}
+
+
+int codec_can_stream( const void *data, size_t len, const char *format )
+{
+    // interlace method of IHDR chunk
+    if( strcasecmp( format, "png" ) == 0 ){
+        return len > 28 && ((const uint8_t*)data)[28] == 0;
+    }
+    
+    return codec_can_decode( format );
+}
+
+
+void codec_cover_size( int *cw, int *ch, int w, int h, 
+                       const codec_hint_t *hint )
+{
+    // scale by num / den
+    int64_t num = 1;
+    int64_t den = 1;
+    
+    if( hint->w > 0 ){
+        num = hint->w;
+        den = w;
+    }
+    // the side that needs the larger scale
+    if( hint->h > 0 && (int64_t)hint->h * den > num * h ){
+        num = hint->h;
+        den = h;
+    }
+    
+    *cw = w;
+    *ch = h;
+    if( num < den ){
+        *cw = (int)( ( (int64_t)w * num + den - 1 ) / den );
+        *ch = (int)( ( (int64_t)h * num + den - 1 ) / den );
+        *cw = *cw < 1 ? 1 : *cw;
+        *ch = *ch < 1 ? 1 : *ch;
+    }
+}
+
+
+int codec_decode( codec_img_t *dst, const void *data, size_t len, 
+                  const char *format, const codec_hint_t *hint )
+{
+    if( strcasecmp( format, "png" ) == 0 ){
+        return codec_decode_png( dst, data, len, hint );
+    }
+    else if( strcasecmp( format, "jpg" ) == 0 || 
+             strcasecmp( format, "jpeg" ) == 0 ){
+        return codec_decode_jpeg( dst, data, len, hint );
+    }
+    
+    // unsupported format
+    errno = EINVAL;
+    return -1;
+}
+
+
+// reverse the order of n pixels
+static inline void reverse_pixels( uint32_t *px, size_t n )
+{
+    uint32_t *end = px + n - 1;
+    uint32_t v = 0;
+    
+    for(; px < end; px++, end-- ){
+        v = *px;
+        *px = *end;
+        *end = v;
+    }
+}
+
+
+int codec_orient( codec_img_t *img, int orientation )
+{
+    size_t w = (size_t)img->w;
+    size_t h = (size_t)img->h;
+    size_t bytes = sizeof( uint32_t ) * w * h;
+    uint32_t *src = img->pixels;
+    uint32_t *dst = NULL;
+    size_t x = 0;
+    size_t y = 0;
+    int v = 0;
+    
+    switch( orientation )
+    {
+        // mirror horizontal
+        case 2:
+            for(; y < h; y++ ){
+                reverse_pixels( src + y * w, w );
+            }
+            return 0;
+        // rotate 180
+        case 3:
+            reverse_pixels( src, w * h );
+            return 0;
+        // mirror vertical
+        case 4:
+            for(; y < h / 2; y++ )
+            {
+                uint32_t *a = src + y * w;
+                uint32_t *b = src + ( h - 1 - y ) * w;
+                uint32_t tmp = 0;
+                
+                for( x = 0; x < w; x++ ){
+                    tmp = a[x];
+                    a[x] = b[x];
+                    b[x] = tmp;
+                }
+            }
+            return 0;
+        // transpose, rotate 90 CW, transverse and rotate 90 CCW
+        case 5:
+        case 6:
+        case 7:
+        case 8:
+            if( !( dst = bufpool_alloc( bytes ) ) ){
+                errno = ENOMEM;
+                return -1;
+            }
+            // the source pixel (x, y) moves to (dx, dy) of h x w image
+            for(; y < h; y++, src += w )
+            {
+                size_t dx = orientation == 5 || orientation == 8 ? y : 
+                            h - 1 - y;
+                
+                if( orientation == 5 || orientation == 6 ){
+                    for( x = 0; x < w; x++ ){
+                        dst[x * h + dx] = src[x];
+                    }
+                }
+                else {
+                    for( x = 0; x < w; x++ ){
+                        dst[( w - 1 - x ) * h + dx] = src[x];
+                    }
+                }
+            }
+            bufpool_free( img->pixels, bytes );
+            img->pixels = dst;
+            v = img->w;
+            img->w = img->h;
+            img->h = v;
+            v = img->orig_w;
+            img->orig_w = img->orig_h;
+            img->orig_h = v;
+            return 0;
+    }
+    
+    return 0;
+}
+
+
+int codec_raw_format( const char *name )
+{
+    static const char *names[] = {
+        "argb32", "bgra", "rgba", "rgb24", "bgr24", NULL
+    };
+    int i = 0;
+    
+    for(; names[i]; i++ ){
+        if( strcasecmp( name, names[i] ) == 0 ){
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+
+int codec_raw_bpp( int fmt )
+{
+    return fmt == CODEC_RAW_RGB24 || fmt == CODEC_RAW_BGR24 ? 3 : 4;
+}
+
+
+int codec_raw_is_native( int fmt )
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return fmt == CODEC_RAW_ARGB32;
+#else
+    return fmt == CODEC_RAW_ARGB32 || fmt == CODEC_RAW_BGRA;
+#endif
+}
+
+
+// convert a row of the byte ordered pixels. r, g, b and a are the byte 
+// offsets of the channels, and a is -1 if the pixels have no alpha.
+static inline void raw2argb( uint32_t *px, const uint8_t *row, int w, int bpp, 
+                             int r, int g, int b, int a )
+{
+    int x = 0;
+    
+    for(; x < w; x++, row += bpp ){
+        px[x] = ( a < 0 ? 0xFF000000U : (uint32_t)row[a] << 24 ) | 
+                (uint32_t)row[r] << 16 | (uint32_t)row[g] << 8 | 
+                (uint32_t)row[b];
+    }
+}
+
+
+void codec_raw_convert( uint32_t *dst, const void *src, int w, int h, 
+                        size_t stride, int fmt )
+{
+    const uint8_t *row = (const uint8_t*)src;
+    size_t len = sizeof( uint32_t ) * (size_t)w;
+    int y = 0;
+    
+    // copy at once if the pixels are not padded
+    if( codec_raw_is_native( fmt ) && stride == len ){
+        memcpy( dst, src, len * (size_t)h );
+        return;
+    }
+    
+    for(; y < h; y++, row += stride, dst += w )
+    {
+        switch( fmt ){
+            case CODEC_RAW_RGBA:
+                raw2argb( dst, row, w, 4, 0, 1, 2, 3 );
+            break;
+            case CODEC_RAW_RGB24:
+                raw2argb( dst, row, w, 3, 0, 1, 2, -1 );
+            break;
+            case CODEC_RAW_BGR24:
+                raw2argb( dst, row, w, 3, 2, 1, 0, -1 );
+            break;
+            default:
+                if( codec_raw_is_native( fmt ) ){
+                    memcpy( dst, row, len );
+                }
+                else {
+                    raw2argb( dst, row, w, 4, 2, 1, 0, 3 );
+                }
+        }
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  codec.h
+ *  lua-thumbnailer
+ *
+ *  native image encoders and decoders.
+ *
+ */
+
+#ifndef ___THUMBNAILER_CODEC_H___
+#define ___THUMBNAILER_CODEC_H___
+
+#include <stdint.h>
+#include "membuf.h"
+
+// chroma subsampling of jpeg encoder
+enum {
+    CODEC_SUBSAMPLING_DEFAULT = 0,
+    CODEC_SUBSAMPLING_444,
+    CODEC_SUBSAMPLING_422,
+    CODEC_SUBSAMPLING_420
+};
+
+// DCT method of jpeg encoder
+enum {
+    CODEC_DCT_DEFAULT = 0,
+    CODEC_DCT_ACCURATE,
+    CODEC_DCT_FAST,
+    CODEC_DCT_FLOAT
+};
+
+// row filter of png encoder
+enum {
+    CODEC_PNG_FILTER_DEFAULT = 0,
+    CODEC_PNG_FILTER_NONE,
+    CODEC_PNG_FILTER_SUB,
+    CODEC_PNG_FILTER_UP,
+    CODEC_PNG_FILTER_AVG,
+    CODEC_PNG_FILTER_PAETH,
+    // select the filter of each row adaptively
+    CODEC_PNG_FILTER_ALL
+};
+
+// options of the native encoders. zero value selects the default.
+typedef struct {
+    // jpeg
+    uint8_t subsampling;
+    uint8_t progressive;
+    // optimize huffman tables
+    uint8_t optimize;
+    uint8_t dct;
+    // png: zlib compression level + 1, or 0 to derive from the quality
+    uint8_t level;
+    uint8_t filter;
+    // webp
+    uint8_t lossless;
+    // encode at the highest quality that the output fits in max_bytes by 
+    // the lossy encoders. 0 to encode at the quality.
+    size_t max_bytes;
+} codec_opts_t;
+
+
+// pixels are 32-bit ARGB (0xAARRGGBB) in native byte order
+typedef struct {
+    const uint32_t *pixels;
+    int w;
+    int h;
+    int alpha;
+    uint8_t quality;
+    // NULL to use the default options
+    const codec_opts_t *opts;
+} codec_src_t;
+
+
+// returns 1 if the format string is supported by the native encoders
+int codec_is_native( const char *format );
+
+// encode the source image into buf by format string.
+// returns 0 on success, or -1 on failure with errno.
+int codec_encode( membuf_t *buf, codec_src_t *src, const char *format );
+
+int codec_encode_jpeg( membuf_t *buf, codec_src_t *src );
+int codec_encode_png( membuf_t *buf, codec_src_t *src );
+int codec_encode_webp( membuf_t *buf, codec_src_t *src );
+
+
+// decoded image. pixels are allocated by bufpool_alloc and owned by caller.
+typedef struct {
+    uint32_t *pixels;
+    int w;
+    int h;
+    int alpha;
+    // size of the source image before scaled decoding
+    int orig_w;
+    int orig_h;
+} codec_img_t;
+
+
+// minimum size of decoded image that decoder can reduce the source image 
+// to. 0 to decode at full size.
+typedef struct {
+    int w;
+    int h;
+    // decode row by row and reduce the rows to the smallest size that covers 
+    // the hint size without holding the whole image.
+    int stream;
+    // apply the EXIF orientation to the decoded image. the hint size is the 
+    // size of the upright image.
+    int orient;
+    // decode the embedded EXIF thumbnail instead if it covers the hint size
+    int thumbnail;
+} codec_hint_t;
+
+
+// returns 1 if the data of format can be decoded by streaming decode with 
+// the reduced pixels only. interlaced png needs the whole image.
+int codec_can_stream( const void *data, size_t len, const char *format );
+
+// calculate the smallest size of w x h image that covers the hint size
+void codec_cover_size( int *cw, int *ch, int w, int h, 
+                       const codec_hint_t *hint );
+
+
+// returns format name of encoded data, or NULL if unknown
+const char *codec_sniff( const void *data, size_t len );
+
+// returns 1 if the format string is supported by the native decoders
+int codec_can_decode( const char *format );
+
+// decode the encoded data by format string.
+// returns 0 on success, or -1 on failure with errno.
+int codec_decode( codec_img_t *dst, const void *data, size_t len, 
+                  const char *format, const codec_hint_t *hint );
+
+int codec_decode_jpeg( codec_img_t *dst, const void *data, size_t len, 
+                       const codec_hint_t *hint );
+int codec_decode_png( codec_img_t *dst, const void *data, size_t len, 
+                      const codec_hint_t *hint );
+
+// transform the decoded image by the EXIF orientation (1-8) to the upright 
+// image. the orientation 5-8 swaps the width and height, and replaces the 
+// pixels by the transposed pixels.
+// returns 0 on success, or -1 on failure with errno.
+int codec_orient( codec_img_t *img, int orientation );
+
+
+// layouts of the raw pixels
+enum {
+    // 32-bit ARGB in native byte order
+    CODEC_RAW_ARGB32 = 0,
+    // byte order of the following formats
+    CODEC_RAW_BGRA,
+    CODEC_RAW_RGBA,
+    CODEC_RAW_RGB24,
+    CODEC_RAW_BGR24
+};
+
+// returns the raw pixel format of name, or -1 if name is unknown
+int codec_raw_format( const char *name );
+
+// returns the bytes per pixel of the raw pixel format
+int codec_raw_bpp( int fmt );
+
+// returns 1 if the raw pixel format is stored as same as CODEC_RAW_ARGB32
+int codec_raw_is_native( int fmt );
+
+// convert the raw pixels of w x h that row length is stride bytes into 
+// 32-bit ARGB pixels. alpha of the 24-bit formats is 0xff.
+void codec_raw_convert( uint32_t *dst, const void *src, int w, int h, 
+                        size_t stride, int fmt );
+
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  codec_jpeg.c
+ *  lua-thumbnailer
+ *
+ *  JPEG codec on top of libjpeg.
+ *
+ */
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <jerror.h>
+#include "codec.h"
+#include "bufpool.h"
+#include "resample.h"
+
+#define JPEG_DEST_CHUNK 16384
+
+// decode into ARGB32 pixels directly if libjpeg-turbo extensions available
+#if defined(JCS_ALPHA_EXTENSIONS) && defined(__BYTE_ORDER__)
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        #define JPEG_DIRECT_CS  JCS_EXT_BGRA
+    #else
+        #define JPEG_DIRECT_CS  JCS_EXT_ARGB
+    #endif
+#endif
+
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf env;
+    int errnum;
+} jpeg_err_t;
+
+
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    membuf_t *buf;
+} jpeg_dest_t;
+
+
+static void err_exit( j_common_ptr cinfo )
+{
+    jpeg_err_t *err = (jpeg_err_t*)cinfo->err;
+    
+    err->errnum = ( err->pub.msg_code == JERR_OUT_OF_MEMORY ) ? ENOMEM : 
+                  EINVAL;
+    longjmp( err->env, 1 );
+}
+
+
+static void err_output( j_common_ptr cinfo )
+{
+    // suppress messages to stderr
+    (void)cinfo;
+}
+
+
+static inline void err_init( jpeg_err_t *err )
+{
+    jpeg_std_error( &err->pub );
+    err->pub.error_exit = err_exit;
+    err->pub.output_message = err_output;
+    err->errnum = 0;
+}
+
+
+static inline int dest_reserve( j_compress_ptr cinfo )
+{
+    jpeg_dest_t *dest = (jpeg_dest_t*)cinfo->dest;
+    
+    if( membuf_reserve( dest->buf, JPEG_DEST_CHUNK ) != 0 ){
+        ERREXIT( cinfo, JERR_OUT_OF_MEMORY );
+    }
+    dest->pub.next_output_byte = dest->buf->data + dest->buf->len;
+    dest->pub.free_in_buffer = dest->buf->cap - dest->buf->len;
+    
+    return TRUE;
+}
+
+
+static void dest_init( j_compress_ptr cinfo )
+{
+    dest_reserve( cinfo );
+}
+
+
+static boolean dest_empty( j_compress_ptr cinfo )
+{
+    jpeg_dest_t *dest = (jpeg_dest_t*)cinfo->dest;
+    
+    // whole free space has been filled
+    dest->buf->len = dest->buf->cap;
+    
+    return dest_reserve( cinfo );
+}
+
+
+static void dest_term( j_compress_ptr cinfo )
+{
+    jpeg_dest_t *dest = (jpeg_dest_t*)cinfo->dest;
+    
+    dest->buf->len = dest->buf->cap - dest->pub.free_in_buffer;
+}
+
+
+static void set_options( j_compress_ptr cinfo, const codec_opts_t *opts )
+{
+    // sampling factors of luminance
+    switch( opts->subsampling ){
+        case CODEC_SUBSAMPLING_444:
+            cinfo->comp_info[0].h_samp_factor = 1;
+            cinfo->comp_info[0].v_samp_factor = 1;
+        break;
+        case CODEC_SUBSAMPLING_422:
+            cinfo->comp_info[0].h_samp_factor = 2;
+            cinfo->comp_info[0].v_samp_factor = 1;
+        break;
+        case CODEC_SUBSAMPLING_420:
+            cinfo->comp_info[0].h_samp_factor = 2;
+            cinfo->comp_info[0].v_samp_factor = 2;
+        break;
+    }
+    switch( opts->dct ){
+        case CODEC_DCT_ACCURATE:
+            cinfo->dct_method = JDCT_ISLOW;
+        break;
+        case CODEC_DCT_FAST:
+            cinfo->dct_method = JDCT_IFAST;
+        break;
+        case CODEC_DCT_FLOAT:
+            cinfo->dct_method = JDCT_FLOAT;
+        break;
+    }
+    if( opts->optimize ){
+        cinfo->optimize_coding = TRUE;
+    }
+    if( opts->progressive ){
+        jpeg_simple_progression( cinfo );
+    }
+}
+
+
+int codec_encode_jpeg( membuf_t *buf, codec_src_t *src )
+{
+    struct jpeg_compress_struct cinfo;
+    jpeg_err_t err;
+    jpeg_dest_t dest;
+    JSAMPROW row = malloc( sizeof( JSAMPLE ) * 3 * (size_t)src->w );
+    const uint32_t *px = NULL;
+    int x = 0;
+    
+    if( !row ){
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    cinfo.err = (struct jpeg_error_mgr*)&err;
+    err_init( &err );
+    if( setjmp( err.env ) ){
+        jpeg_destroy_compress( &cinfo );
+        free( row );
+        errno = err.errnum;
+        return -1;
+    }
+    
+    jpeg_create_compress( &cinfo );
+    dest.buf = buf;
+    dest.pub.init_destination = dest_init;
+    dest.pub.empty_output_buffer = dest_empty;
+    dest.pub.term_destination = dest_term;
+    cinfo.dest = (struct jpeg_destination_mgr*)&dest;
+    
+    cinfo.image_width = (JDIMENSION)src->w;
+    cinfo.image_height = (JDIMENSION)src->h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults( &cinfo );
+    jpeg_set_quality( &cinfo, src->quality, TRUE );
+    if( src->opts ){
+        set_options( &cinfo, src->opts );
+    }
+    jpeg_start_compress( &cinfo, TRUE );
+    
+    while( cinfo.next_scanline < cinfo.image_height )
+    {
+        px = src->pixels + (size_t)cinfo.next_scanline * (size_t)src->w;
+        for( x = 0; x < src->w; x++ ){
+            row[x*3] = (JSAMPLE)( px[x] >> 16 );
+            row[x*3+1] = (JSAMPLE)( px[x] >> 8 );
+            row[x*3+2] = (JSAMPLE)px[x];
+        }
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+    
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+    free( row );
+    
+    return 0;
+}
+
+
+static void src_init( j_decompress_ptr cinfo )
+{
+    (void)cinfo;
+}
+
+
+static boolean src_fill( j_decompress_ptr cinfo )
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    
+    // premature end of data: insert a fake EOI marker
+    WARNMS( cinfo, JWRN_JPEG_EOF );
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    
+    return TRUE;
+}
+
+
+static void src_skip( j_decompress_ptr cinfo, long bytes )
+{
+    struct jpeg_source_mgr *src = cinfo->src;
+    
+    if( bytes > 0 )
+    {
+        if( (size_t)bytes > src->bytes_in_buffer ){
+            src_fill( cinfo );
+        }
+        else {
+            src->next_input_byte += (size_t)bytes;
+            src->bytes_in_buffer -= (size_t)bytes;
+        }
+    }
+}
+
+
+static void src_term( j_decompress_ptr cinfo )
+{
+    (void)cinfo;
+}
+
+
+static inline void cmyk2argb( uint32_t *px, JSAMPROW row, int w, int inverted )
+{
+    int c, m, y, k;
+    int x = 0;
+    
+    for(; x < w; x++, row += 4 )
+    {
+        // adobe writes inverted CMYK
+        if( inverted ){
+            c = row[0]; m = row[1]; y = row[2]; k = row[3];
+        }
+        else {
+            c = 255 - row[0]; m = 255 - row[1]; 
+            y = 255 - row[2]; k = 255 - row[3];
+        }
+        px[x] = 0xFF000000U | (uint32_t)( c * k / 255 ) << 16 | 
+                (uint32_t)( m * k / 255 ) << 8 | (uint32_t)( y * k / 255 );
+    }
+}
+
+
+static inline void rgb2argb( uint32_t *px, JSAMPROW row, int w )
+{
+    int x = 0;
+    
+    for(; x < w; x++, row += 3 ){
+        px[x] = 0xFF000000U | (uint32_t)row[0] << 16 | 
+                (uint32_t)row[1] << 8 | (uint32_t)row[2];
+    }
+}
+
+
+// select the smallest DCT scaling that still covers the hint size
+static void scale_to_hint( j_decompress_ptr cinfo, const codec_hint_t *hint )
+{
+    unsigned int denom = 8;
+    
+    cinfo->scale_num = 1;
+    for(; denom > 1; denom >>= 1 )
+    {
+        cinfo->scale_denom = denom;
+        jpeg_calc_output_dimensions( cinfo );
+        if( cinfo->output_width >= (JDIMENSION)hint->w && 
+            cinfo->output_height >= (JDIMENSION)hint->h ){
+            return;
+        }
+    }
+    cinfo->scale_denom = 1;
+}
+
+
+int codec_decode_jpeg( codec_img_t *dst, const void *data, size_t len, 
+                       const codec_hint_t *hint )
+{
+    struct jpeg_decompress_struct cinfo;
+    jpeg_err_t err;
+    struct jpeg_source_mgr src;
+    uint32_t *volatile pixels = NULL;
+    JSAMPROW volatile row = NULL;
+    size_t volatile bytes = 0;
+    // decoded row and reducer of the streaming decode
+    uint32_t *volatile srow = NULL;
+    resample_stream_t *volatile stream = NULL;
+    JSAMPROW line = NULL;
+    uint32_t *px = NULL;
+    int ncomp = 3;
+    int w = 0;
+    int h = 0;
+    
+    cinfo.err = (struct jpeg_error_mgr*)&err;
+    err_init( &err );
+    if( setjmp( err.env ) ){
+        jpeg_destroy_decompress( &cinfo );
+        free( row );
+        free( srow );
+        resample_stream_free( stream );
+        bufpool_free( pixels, bytes );
+        errno = err.errnum;
+        return -1;
+    }
+    
+    jpeg_create_decompress( &cinfo );
+    src.next_input_byte = (const JOCTET*)data;
+    src.bytes_in_buffer = len;
+    src.init_source = src_init;
+    src.fill_input_buffer = src_fill;
+    src.skip_input_data = src_skip;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = src_term;
+    cinfo.src = &src;
+    
+    jpeg_read_header( &cinfo, TRUE );
+    if( hint && ( hint->w > 0 || hint->h > 0 ) ){
+        scale_to_hint( &cinfo, hint );
+    }
+    switch( cinfo.jpeg_color_space ){
+        case JCS_CMYK:
+        case JCS_YCCK:
+            cinfo.out_color_space = JCS_CMYK;
+            ncomp = 4;
+        break;
+        default:
+#ifdef JPEG_DIRECT_CS
+            cinfo.out_color_space = JPEG_DIRECT_CS;
+            ncomp = 0;
+#else
+            cinfo.out_color_space = JCS_RGB;
+#endif
+    }
+    jpeg_start_decompress( &cinfo );
+    
+    w = (int)cinfo.output_width;
+    h = (int)cinfo.output_height;
+    if( hint && hint->stream ){
+        codec_cover_size( &w, &h, (int)cinfo.image_width, 
+                          (int)cinfo.image_height, hint );
+        w = w < (int)cinfo.output_width ? w : (int)cinfo.output_width;
+        h = h < (int)cinfo.output_height ? h : (int)cinfo.output_height;
+    }
+    bytes = sizeof( uint32_t ) * (size_t)w * (size_t)h;
+    if( !( pixels = bufpool_alloc( bytes ) ) || 
+        ( ncomp && !( row = malloc( (size_t)ncomp * 
+                                    (size_t)cinfo.output_width ) ) ) ){
+        ERREXIT( &cinfo, JERR_OUT_OF_MEMORY );
+    }
+    // reduce the rows while decoding
+    else if( ( w < (int)cinfo.output_width || 
+               h < (int)cinfo.output_height ) && 
+             ( !( srow = malloc( sizeof( uint32_t ) * 
+                                 (size_t)cinfo.output_width ) ) || 
+               !( stream = resample_stream_new( pixels, w, h, 
+                                                (int)cinfo.output_width, 
+                                                (int)cinfo.output_height ) ) ) ){
+        ERREXIT( &cinfo, JERR_OUT_OF_MEMORY );
+    }
+    
+    while( cinfo.output_scanline < cinfo.output_height )
+    {
+        px = stream ? srow : pixels + (size_t)cinfo.output_scanline * 
+                                      (size_t)cinfo.output_width;
+        switch( ncomp ){
+            // decode into pixels directly
+            case 0:
+                line = (JSAMPROW)px;
+                jpeg_read_scanlines( &cinfo, &line, 1 );
+            break;
+            case 4:
+                line = row;
+                jpeg_read_scanlines( &cinfo, &line, 1 );
+                cmyk2argb( px, line, (int)cinfo.output_width, 
+                           cinfo.saw_Adobe_marker );
+            break;
+            default:
+                line = row;
+                jpeg_read_scanlines( &cinfo, &line, 1 );
+                rgb2argb( px, line, (int)cinfo.output_width );
+        }
+        if( stream ){
+            resample_stream_row( stream, px );
+        }
+    }
+    
+    dst->pixels = pixels;
+    dst->w = w;
+    dst->h = h;
+    dst->alpha = 0;
+    dst->orig_w = (int)cinfo.image_width;
+    dst->orig_h = (int)cinfo.image_height;
+    jpeg_finish_decompress( &cinfo );
+    jpeg_destroy_decompress( &cinfo );
+    free( row );
+    free( srow );
+    resample_stream_free( stream );
+    
+    return 0;
+}
+
@@ -0,0 +1,334 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  codec_png.c
+ *  lua-thumbnailer
+ *
+ *  PNG codec on top of libpng.
+ *
+ */
+
+#include <png.h>
+#include "codec.h"
+#include "bufpool.h"
+#include "resample.h"
+
+typedef struct {
+    membuf_t *buf;
+    int errnum;
+    // read position of encoded data
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} png_io_t;
+
+
+static void err_exit( png_structp png, png_const_charp msg )
+{
+    png_io_t *io = (png_io_t*)png_get_error_ptr( png );
+    
+    (void)msg;
+    if( !io->errnum ){
+        io->errnum = EINVAL;
+    }
+    png_longjmp( png, 1 );
+}
+
+
+static void err_warn( png_structp png, png_const_charp msg )
+{
+    // suppress warnings
+    (void)png;
+    (void)msg;
+}
+
+
+static void write_data( png_structp png, png_bytep data, png_size_t len )
+{
+    png_io_t *io = (png_io_t*)png_get_io_ptr( png );
+    
+    if( membuf_append( io->buf, data, len ) != 0 ){
+        io->errnum = ENOMEM;
+        png_error( png, "out of memory" );
+    }
+}
+
+
+static void flush_data( png_structp png )
+{
+    (void)png;
+}
+
+
+// png filters of CODEC_PNG_FILTER_*
+static const int FILTERS[] = {
+    0,
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVG,
+    PNG_FILTER_PAETH,
+    PNG_ALL_FILTERS
+};
+
+
+// returns the number of channels to encode
+static int components( codec_src_t *src )
+{
+    return src->alpha ? 4 : 3;
+}
+
+
+static int compression_level( codec_src_t *src )
+{
+    // same as the compression level of imlib2 png saver by default
+    int level = 9 - src->quality / 10;
+    
+    if( src->opts && src->opts->level ){
+        level = src->opts->level - 1;
+    }
+    
+    return level < 0 ? 0 : level;
+}
+
+
+int codec_encode_png( membuf_t *buf, codec_src_t *src )
+{
+    png_io_t io = { buf, 0, NULL, 0, 0 };
+    png_structp png = NULL;
+    png_infop info = NULL;
+    int ncomp = 0;
+    png_bytep row = malloc( 4 * (size_t)src->w );
+    const uint32_t *px = NULL;
+    int x = 0;
+    int y = 0;
+    
+    if( !row ){
+        errno = ENOMEM;
+        return -1;
+    }
+    else if( !( png = png_create_write_struct( PNG_LIBPNG_VER_STRING, &io, 
+                                               err_exit, err_warn ) ) || 
+             !( info = png_create_info_struct( png ) ) ){
+        png_destroy_write_struct( &png, NULL );
+        free( row );
+        errno = ENOMEM;
+        return -1;
+    }
+    else if( setjmp( png_jmpbuf( png ) ) ){
+        png_destroy_write_struct( &png, &info );
+        free( row );
+        errno = io.errnum;
+        return -1;
+    }
+    
+    ncomp = components( src );
+    png_set_write_fn( png, &io, write_data, flush_data );
+    png_set_IHDR( png, info, (png_uint_32)src->w, (png_uint_32)src->h, 8, 
+                  ncomp == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB, 
+                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, 
+                  PNG_FILTER_TYPE_DEFAULT );
+    png_set_compression_level( png, compression_level( src ) );
+    if( src->opts && src->opts->filter ){
+        png_set_filter( png, PNG_FILTER_TYPE_BASE, 
+                        FILTERS[src->opts->filter] );
+    }
+    png_write_info( png, info );
+    
+    for( y = 0; y < src->h; y++ )
+    {
+        png_bytep p = row;
+        
+        px = src->pixels + (size_t)y * (size_t)src->w;
+        for( x = 0; x < src->w; x++ ){
+            *p++ = (png_byte)( px[x] >> 16 );
+            *p++ = (png_byte)( px[x] >> 8 );
+            *p++ = (png_byte)px[x];
+            if( ncomp == 4 ){
+                *p++ = (png_byte)( px[x] >> 24 );
+            }
+        }
+        png_write_row( png, row );
+    }
+    
+    png_write_end( png, info );
+    png_destroy_write_struct( &png, &info );
+    free( row );
+    
+    return 0;
+}
+
+
+static void read_data( png_structp png, png_bytep data, png_size_t len )
+{
+    png_io_t *io = (png_io_t*)png_get_io_ptr( png );
+    
+    if( len > io->len - io->pos ){
+        png_error( png, "unexpected end of data" );
+    }
+    memcpy( data, io->data + io->pos, len );
+    io->pos += len;
+}
+
+
+// read the whole image into pixels by the row pointers of h rows
+static void read_image( png_structp png, uint32_t *pixels, png_uint_32 w, 
+                        png_uint_32 h, png_bytepp rows )
+{
+    png_uint_32 y = 0;
+    
+    for(; y < h; y++ ){
+        rows[y] = (png_bytep)( pixels + (size_t)y * (size_t)w );
+    }
+    png_read_image( png, rows );
+}
+
+
+int codec_decode_png( codec_img_t *dst, const void *data, size_t len, 
+                      const codec_hint_t *hint )
+{
+    png_io_t io = { NULL, 0, (const uint8_t*)data, len, 0 };
+    png_structp png = NULL;
+    png_infop info = NULL;
+    uint32_t *volatile pixels = NULL;
+    png_bytepp volatile rows = NULL;
+    size_t volatile bytes = 0;
+    // decoded row and reducer of the streaming decode
+    uint32_t *volatile srow = NULL;
+    size_t volatile sbytes = 0;
+    resample_stream_t *volatile stream = NULL;
+    png_uint_32 w = 0;
+    png_uint_32 h = 0;
+    png_uint_32 y = 0;
+    int cw = 0;
+    int ch = 0;
+    int interlaced = 0;
+    int depth = 0;
+    int ctype = 0;
+    int alpha = 0;
+    
+    if( !( png = png_create_read_struct( PNG_LIBPNG_VER_STRING, &io, 
+                                         err_exit, err_warn ) ) || 
+        !( info = png_create_info_struct( png ) ) ){
+        png_destroy_read_struct( &png, NULL, NULL );
+        errno = ENOMEM;
+        return -1;
+    }
+    else if( setjmp( png_jmpbuf( png ) ) ){
+        png_destroy_read_struct( &png, &info, NULL );
+        free( rows );
+        bufpool_free( srow, sbytes );
+        resample_stream_free( stream );
+        bufpool_free( pixels, bytes );
+        errno = io.errnum;
+        return -1;
+    }
+    
+    png_set_read_fn( png, &io, read_data );
+    png_read_info( png, info );
+    png_get_IHDR( png, info, &w, &h, &depth, &ctype, &interlaced, NULL, 
+                  NULL );
+    alpha = ( ctype & PNG_COLOR_MASK_ALPHA ) || 
+            png_get_valid( png, info, PNG_INFO_tRNS );
+    
+    // convert to 8-bit ARGB32
+    if( ctype == PNG_COLOR_TYPE_PALETTE ){
+        png_set_palette_to_rgb( png );
+    }
+    else if( ctype == PNG_COLOR_TYPE_GRAY && depth < 8 ){
+        png_set_expand_gray_1_2_4_to_8( png );
+    }
+    if( png_get_valid( png, info, PNG_INFO_tRNS ) ){
+        png_set_tRNS_to_alpha( png );
+    }
+    if( depth == 16 ){
+        png_set_strip_16( png );
+    }
+    if( !( ctype & PNG_COLOR_MASK_COLOR ) ){
+        png_set_gray_to_rgb( png );
+    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if( alpha ){
+        png_set_swap_alpha( png );
+    }
+    else {
+        png_set_filler( png, 0xFF, PNG_FILLER_BEFORE );
+    }
+#else
+    png_set_bgr( png );
+    if( !alpha ){
+        png_set_filler( png, 0xFF, PNG_FILLER_AFTER );
+    }
+#endif
+    png_set_interlace_handling( png );
+    png_read_update_info( png, info );
+    
+    // png cannot be decoded at reduced size, but the rows can be reduced.
+    // interlaced rows are completed after the last pass, so they are not.
+    cw = (int)w;
+    ch = (int)h;
+    if( hint && hint->stream && interlaced == PNG_INTERLACE_NONE ){
+        codec_cover_size( &cw, &ch, (int)w, (int)h, hint );
+    }
+    if( cw == (int)w && ch == (int)h ){
+        bytes = sizeof( uint32_t ) * (size_t)w * (size_t)h;
+        if( !( pixels = bufpool_alloc( bytes ) ) || 
+            !( rows = malloc( sizeof( png_bytep ) * (size_t)h ) ) ){
+            io.errnum = ENOMEM;
+            png_error( png, "out of memory" );
+        }
+        read_image( png, pixels, w, h, rows );
+    }
+    else
+    {
+        bytes = sizeof( uint32_t ) * (size_t)cw * (size_t)ch;
+        sbytes = sizeof( uint32_t ) * (size_t)w;
+        if( !( pixels = bufpool_alloc( bytes ) ) || 
+            !( srow = bufpool_alloc( sbytes ) ) || 
+            !( stream = resample_stream_new( pixels, cw, ch, (int)w, 
+                                             (int)h ) ) ){
+            io.errnum = ENOMEM;
+            png_error( png, "out of memory" );
+        }
+        for( y = 0; y < h; y++ ){
+            png_read_row( png, (png_bytep)srow, NULL );
+            resample_stream_row( stream, srow );
+        }
+        bufpool_free( srow, sbytes );
+        srow = NULL;
+        resample_stream_free( stream );
+        stream = NULL;
+    }
+    png_read_end( png, NULL );
+    
+    dst->pixels = pixels;
+    dst->w = cw;
+    dst->h = ch;
+    dst->alpha = alpha;
+    dst->orig_w = (int)w;
+    dst->orig_h = (int)h;
+    png_destroy_read_struct( &png, &info, NULL );
+    free( rows );
+    
+    return 0;
+}
+
@@ -0,0 +1,121 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  codec_webp.c
+ *  lua-thumbnailer
+ *
+ *  WebP encoder on top of libwebp.
+ *
+ */
+
+#include <webp/encode.h>
+#include "codec.h"
+#include "bufpool.h"
+
+
+static int write_data( const uint8_t *data, size_t len, 
+                       const WebPPicture *pic )
+{
+    return membuf_append( (membuf_t*)pic->custom_ptr, data, len ) == 0;
+}
+
+
+// returns 1 if the alpha values of the opaque image must be filled
+static int needs_fill( codec_src_t *src )
+{
+    const uint32_t *px = src->pixels;
+    const uint32_t *end = px + (size_t)src->w * (size_t)src->h;
+    
+    if( !src->alpha ){
+        for(; px < end; px++ ){
+            if( *px < 0xFF000000U ){
+                return 1;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+
+int codec_encode_webp( membuf_t *buf, codec_src_t *src )
+{
+    size_t bytes = sizeof( uint32_t ) * (size_t)src->w * (size_t)src->h;
+    uint32_t *argb = NULL;
+    WebPConfig config;
+    WebPPicture pic;
+    size_t i = 0;
+    int rc = 0;
+    
+    if( !WebPPictureInit( &pic ) ){
+        errno = EINVAL;
+        return -1;
+    }
+    else if( src->opts && src->opts->lossless ){
+        // quality is the compression effort of lossless encoding
+        rc = WebPConfigLosslessPreset( &config, src->quality / 10 > 9 ? 9 : 
+                                                src->quality / 10 );
+    }
+    else {
+        rc = WebPConfigPreset( &config, WEBP_PRESET_DEFAULT, 
+                               (float)src->quality );
+    }
+    if( !rc ){
+        errno = EINVAL;
+        return -1;
+    }
+    // keep the pixels of the transparent area untouched
+    config.exact = 1;
+    
+    // encoder reads the ARGB32 pixels directly, but the alpha values of the 
+    // opaque image are undefined.
+    if( needs_fill( src ) )
+    {
+        if( !( argb = bufpool_alloc( bytes ) ) ){
+            return -1;
+        }
+        for(; i < (size_t)src->w * (size_t)src->h; i++ ){
+            argb[i] = src->pixels[i] | 0xFF000000U;
+        }
+    }
+    
+    pic.use_argb = 1;
+    pic.width = src->w;
+    pic.height = src->h;
+    pic.argb = argb ? argb : (uint32_t*)src->pixels;
+    pic.argb_stride = src->w;
+    pic.writer = write_data;
+    pic.custom_ptr = buf;
+    rc = 0;
+    if( !WebPEncode( &config, &pic ) ){
+        errno = pic.error_code == VP8_ENC_ERROR_OUT_OF_MEMORY || 
+                pic.error_code == VP8_ENC_ERROR_BITSTREAM_OUT_OF_MEMORY ? 
+                ENOMEM : EINVAL;
+        rc = -1;
+    }
+    // release the buffers that allocated by the encoder
+    pic.argb = NULL;
+    WebPPictureFree( &pic );
+    bufpool_free( argb, bytes );
+    
+    return rc;
+}
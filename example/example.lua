@@ -39,6 +39,15 @@ else
     img:saveAspect( './aspect-cm.png', 0, 1, 1, 255 );
     img:saveAspect( './aspect-cb.png', 0, 1, 1, 255, thumbnailer.CENTER, 
                     thumbnailer.BOTTOM );
+    -- batch
+    img:saveBatch({
+        { path = './batch-fit.jpg', w = 320, h = 240, format = 'jpg', 
+          quality = 80 },
+        { path = './batch-crop.png', w = 100, h = 100, mode = 'crop', 
+          halign = thumbnailer.LEFT },
+        { path = './batch-aspect.png', w = 160, h = 90, mode = 'aspect', 
+          saturation = 1, lightness = 1 }
+    });
     -- free
     img:free();
 end
@@ -0,0 +1,319 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  fingerprint.c
+ *  lua-thumbnailer
+ *
+ *  perceptual hashes and fingerprint of the decoded pixels.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "fingerprint.h"
+
+// math.h defines M_PI only as an extension of POSIX/XSI, strict -std=c99
+// without _GNU_SOURCE or _XOPEN_SOURCE leaves it undefined.
+#ifndef M_PI
+#define M_PI    3.14159265358979323846
+#endif
+
+// size of the gray image of phash, and the low frequencies of it
+#define PHASH_SIZE  32
+#define PHASH_LOW   8
+// size of the gray image of dhash
+#define DHASH_W     9
+#define DHASH_H     8
+
+
+typedef struct {
+    int i0;
+    int i1;
+} span_t;
+
+
+typedef struct {
+    span_t xs[PHASH_SIZE];
+    span_t ys[PHASH_SIZE];
+    int nx;
+    int ny;
+    double *cells;
+} grid_t;
+
+
+int fingerprint_flag( const char *name )
+{
+    if( strcmp( name, "dhash" ) == 0 ){
+        return FINGERPRINT_DHASH;
+    }
+    else if( strcmp( name, "phash" ) == 0 ){
+        return FINGERPRINT_PHASH;
+    }
+    else if( strcmp( name, "avgcolor" ) == 0 ){
+        return FINGERPRINT_AVGCOLOR;
+    }
+    else if( strcmp( name, "opaque" ) == 0 ){
+        return FINGERPRINT_OPAQUE;
+    }
+    
+    return 0;
+}
+
+
+// split len into n spans. every span has at least one element, so the 
+// spans overlap if len is less than n.
+static void spans_init( span_t *spans, int n, int len )
+{
+    int i = 0;
+    
+    for(; i < n; i++ ){
+        spans[i].i0 = (int)( (int64_t)i * len / n );
+        spans[i].i1 = (int)( (int64_t)( i + 1 ) * len / n );
+        if( spans[i].i1 <= spans[i].i0 ){
+            spans[i].i1 = spans[i].i0 + 1;
+        }
+    }
+}
+
+
+static void grid_init( grid_t *g, double *cells, int nx, int ny, int w, 
+                       int h )
+{
+    g->nx = nx;
+    g->ny = ny;
+    g->cells = cells;
+    spans_init( g->xs, nx, w );
+    spans_init( g->ys, ny, h );
+    memset( cells, 0, sizeof( double ) * (size_t)( nx * ny ) );
+}
+
+
+// add the gray sums of the row y to the cells of the rows that contain y.
+// prefix is the prefix sums of the gray row.
+static void grid_add( grid_t *g, const uint64_t *prefix, int y )
+{
+    int cy = 0;
+    int cx = 0;
+    double *row = NULL;
+    
+    for(; cy < g->ny; cy++ )
+    {
+        if( y >= g->ys[cy].i0 && y < g->ys[cy].i1 ){
+            row = g->cells + cy * g->nx;
+            for( cx = 0; cx < g->nx; cx++ ){
+                row[cx] += (double)( prefix[g->xs[cx].i1] - 
+                                     prefix[g->xs[cx].i0] );
+            }
+        }
+    }
+}
+
+
+// convert the sums of the cells to the averages
+static void grid_mean( grid_t *g )
+{
+    int cy = 0;
+    int cx = 0;
+    double area = 0;
+    
+    for(; cy < g->ny; cy++ ){
+        for( cx = 0; cx < g->nx; cx++ ){
+            area = (double)( g->xs[cx].i1 - g->xs[cx].i0 ) * 
+                   (double)( g->ys[cy].i1 - g->ys[cy].i0 );
+            g->cells[cy * g->nx + cx] /= area;
+        }
+    }
+}
+
+
+static uint64_t dhash( const double *cells )
+{
+    uint64_t hash = 0;
+    int y = 0;
+    int x = 0;
+    
+    for(; y < DHASH_H; y++ ){
+        for( x = 0; x < DHASH_W - 1; x++ ){
+            hash = ( hash << 1 ) | 
+                   ( cells[y * DHASH_W + x] > cells[y * DHASH_W + x + 1] );
+        }
+    }
+    
+    return hash;
+}
+
+
+static int cmp_double( const void *a, const void *b )
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    
+    return ( x > y ) - ( x < y );
+}
+
+
+// the bits are set if the low frequency of the DCT of the gray image is 
+// larger than the median of them except for the DC component.
+static uint64_t phash( const double *cells )
+{
+    double basis[PHASH_LOW][PHASH_SIZE];
+    double rows[PHASH_SIZE][PHASH_LOW];
+    double coef[PHASH_LOW * PHASH_LOW];
+    double sorted[PHASH_LOW * PHASH_LOW - 1];
+    double median = 0;
+    uint64_t hash = 0;
+    int u = 0;
+    int v = 0;
+    int i = 0;
+    
+    for(; u < PHASH_LOW; u++ ){
+        for( i = 0; i < PHASH_SIZE; i++ ){
+            basis[u][i] = cos( M_PI * ( 2 * i + 1 ) * u / ( 2 * PHASH_SIZE ) );
+        }
+    }
+    // separable DCT-II of the rows and then the columns
+    for( i = 0; i < PHASH_SIZE; i++ ){
+        for( u = 0; u < PHASH_LOW; u++ ){
+            rows[i][u] = 0;
+            for( v = 0; v < PHASH_SIZE; v++ ){
+                rows[i][u] += cells[i * PHASH_SIZE + v] * basis[u][v];
+            }
+        }
+    }
+    for( v = 0; v < PHASH_LOW; v++ ){
+        for( u = 0; u < PHASH_LOW; u++ ){
+            coef[v * PHASH_LOW + u] = 0;
+            for( i = 0; i < PHASH_SIZE; i++ ){
+                coef[v * PHASH_LOW + u] += rows[i][u] * basis[v][i];
+            }
+        }
+    }
+    
+    memcpy( sorted, coef + 1, sizeof( sorted ) );
+    qsort( sorted, PHASH_LOW * PHASH_LOW - 1, sizeof( double ), cmp_double );
+    median = sorted[( PHASH_LOW * PHASH_LOW - 1 ) / 2];
+    for( i = 0; i < PHASH_LOW * PHASH_LOW; i++ ){
+        hash = ( hash << 1 ) | ( coef[i] > median );
+    }
+    
+    return hash;
+}
+
+
+int fingerprint( fingerprint_t *fp, const uint32_t *pixels, int w, int h, 
+                 int flags )
+{
+    int gray = flags & ( FINGERPRINT_DHASH|FINGERPRINT_PHASH );
+    int color = flags & ( FINGERPRINT_AVGCOLOR|FINGERPRINT_OPAQUE );
+    double pcells[PHASH_SIZE * PHASH_SIZE];
+    double dcells[DHASH_W * DHASH_H];
+    grid_t pgrid;
+    grid_t dgrid;
+    uint64_t *prefix = NULL;
+    // alpha and alpha weighted colors
+    uint64_t sa = 0;
+    uint64_t sr = 0;
+    uint64_t sg = 0;
+    uint64_t sb = 0;
+    uint32_t opaque = 0xff;
+    const uint32_t *row = pixels;
+    uint32_t px = 0;
+    uint32_t a = 0;
+    int x = 0;
+    int y = 0;
+    
+    memset( fp, 0, sizeof( fingerprint_t ) );
+    if( w < 1 || h < 1 ){
+        errno = EINVAL;
+        return -1;
+    }
+    else if( gray )
+    {
+        if( !( prefix = malloc( sizeof( uint64_t ) * ( (size_t)w + 1 ) ) ) ){
+            return -1;
+        }
+        prefix[0] = 0;
+        grid_init( &pgrid, pcells, PHASH_SIZE, PHASH_SIZE, w, h );
+        grid_init( &dgrid, dcells, DHASH_W, DHASH_H, w, h );
+    }
+    
+    for(; y < h; y++, row += w )
+    {
+        if( gray )
+        {
+            // luma of the pixels composited onto black
+            for( x = 0; x < w; x++ ){
+                px = row[x];
+                a = px >> 24;
+                prefix[x + 1] = prefix[x] + 
+                    ( ( 77 * ( ( px >> 16 ) & 0xff ) + 
+                        150 * ( ( px >> 8 ) & 0xff ) + 
+                        29 * ( px & 0xff ) ) * a / 255 >> 8 );
+            }
+            if( flags & FINGERPRINT_PHASH ){
+                grid_add( &pgrid, prefix, y );
+            }
+            if( flags & FINGERPRINT_DHASH ){
+                grid_add( &dgrid, prefix, y );
+            }
+        }
+        if( color )
+        {
+            for( x = 0; x < w; x++ ){
+                px = row[x];
+                a = px >> 24;
+                opaque &= a;
+                sa += a;
+                sr += ( ( px >> 16 ) & 0xff ) * a;
+                sg += ( ( px >> 8 ) & 0xff ) * a;
+                sb += ( px & 0xff ) * a;
+            }
+        }
+    }
+    free( prefix );
+    
+    if( flags & FINGERPRINT_PHASH ){
+        grid_mean( &pgrid );
+        fp->phash = phash( pcells );
+    }
+    if( flags & FINGERPRINT_DHASH ){
+        grid_mean( &dgrid );
+        fp->dhash = dhash( dcells );
+    }
+    if( flags & FINGERPRINT_AVGCOLOR )
+    {
+        fp->avgcolor = (uint32_t)( ( sa + ( (uint64_t)w * h ) / 2 ) / 
+                                   ( (uint64_t)w * h ) ) << 24;
+        if( sa ){
+            fp->avgcolor |= (uint32_t)( ( sr + sa / 2 ) / sa ) << 16 | 
+                            (uint32_t)( ( sg + sa / 2 ) / sa ) << 8 | 
+                            (uint32_t)( ( sb + sa / 2 ) / sa );
+        }
+    }
+    if( flags & FINGERPRINT_OPAQUE ){
+        fp->opaque = opaque == 0xff;
+    }
+    
+    return 0;
+}
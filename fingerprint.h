@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  fingerprint.h
+ *  lua-thumbnailer
+ *
+ *  perceptual hashes and fingerprint of the decoded pixels.
+ *
+ */
+
+#ifndef ___THUMBNAILER_FINGERPRINT_H___
+#define ___THUMBNAILER_FINGERPRINT_H___
+
+#include <stdint.h>
+
+enum fingerprint_e {
+    // 64-bit difference hash of the 9x8 gray image
+    FINGERPRINT_DHASH = 1 << 0,
+    // 64-bit DCT hash of the 32x32 gray image
+    FINGERPRINT_PHASH = 1 << 1,
+    // alpha weighted average color
+    FINGERPRINT_AVGCOLOR = 1 << 2,
+    // whether all pixels are opaque
+    FINGERPRINT_OPAQUE = 1 << 3,
+    FINGERPRINT_ALL = ( 1 << 4 ) - 1
+};
+
+
+typedef struct {
+    uint64_t dhash;
+    uint64_t phash;
+    // 32-bit ARGB
+    uint32_t avgcolor;
+    int opaque;
+} fingerprint_t;
+
+
+// returns the flag of name, or 0 if name is unknown
+int fingerprint_flag( const char *name );
+
+// compute the fingerprints of flags from the 32-bit ARGB pixels of w x h 
+// in one pass. returns 0 on success, or -1 on failure with errno
+int fingerprint( fingerprint_t *fp, const uint32_t *pixels, int w, int h, 
+                 int flags );
+
+
+#endif
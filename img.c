@@ -0,0 +1,1937 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  img.c
+ *  lua-thumbnailer
+ *
+ *  core image operations without the lua binding.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include "img.h"
+#include "probe.h"
+#include "resample.h"
+#include "stats.h"
+#include "outcache.h"
+#include "bufpool.h"
+
+
+pthread_mutex_t IMLIB_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+// private context that is created at first lock, and never freed because 
+// the images may be released by the other states until the process exits.
+static Imlib_Context IMLIB_CTX = NULL;
+
+
+void img_imlib_lock( void )
+{
+    pthread_mutex_lock( &IMLIB_MUTEX );
+    if( !IMLIB_CTX ){
+        IMLIB_CTX = imlib_context_new();
+    }
+    imlib_context_push( IMLIB_CTX );
+}
+
+
+void img_imlib_unlock( void )
+{
+    // do not leave the image that may be freed by the other thread
+    imlib_context_set_image( NULL );
+    imlib_context_pop();
+    pthread_mutex_unlock( &IMLIB_MUTEX );
+}
+
+
+#define BOUNDS_ALIGN(bounds,align,size) do{ \
+    switch( align ){ \
+        case IMG_ALIGN_CENTER: \
+            bounds.x = ( size.w - bounds.w ) / 2; \
+        break; \
+        case IMG_ALIGN_RIGHT: \
+            bounds.x = size.w - bounds.w; \
+        break; \
+        case IMG_ALIGN_MIDDLE: \
+            bounds.y = ( size.h - bounds.h ) / 2; \
+        break; \
+        case IMG_ALIGN_BOTTOM: \
+            bounds.y = size.h - bounds.h; \
+        break; \
+    } \
+}while(0)
+
+
+
+static inline void liberr2errno( ImlibLoadError err )
+{
+    switch( err )
+    {
+        case IMLIB_LOAD_ERROR_FILE_DOES_NOT_EXIST:
+        case IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT:
+        case IMLIB_LOAD_ERROR_PATH_COMPONENT_NOT_DIRECTORY:
+        case IMLIB_LOAD_ERROR_PATH_POINTS_OUTSIDE_ADDRESS_SPACE:
+            errno = ENOENT;
+        break;
+        case IMLIB_LOAD_ERROR_PATH_TOO_LONG:
+            errno = ENAMETOOLONG;
+        break;
+        case IMLIB_LOAD_ERROR_FILE_IS_DIRECTORY:
+            errno = EISDIR;
+        break;
+        case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_READ:
+        case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_WRITE:
+            errno = EACCES;
+        break;
+        case IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT:
+            errno = EINVAL;
+        break;
+        case IMLIB_LOAD_ERROR_TOO_MANY_SYMBOLIC_LINKS:
+            errno = EMLINK;
+        break;
+        case IMLIB_LOAD_ERROR_OUT_OF_MEMORY:
+            errno = ENOMEM;
+        break;
+        case IMLIB_LOAD_ERROR_OUT_OF_FILE_DESCRIPTORS:
+            errno = EMFILE;
+        break;
+        case IMLIB_LOAD_ERROR_OUT_OF_DISK_SPACE:
+            errno = ENOSPC;
+        break;
+        case IMLIB_LOAD_ERROR_NONE:
+        case IMLIB_LOAD_ERROR_UNKNOWN:
+        break;
+        //default:
+    }
+}
+
+
+
+// MARK: admission control
+// max number of pixels of the image. 0 is unlimited.
+static size_t LIMIT_PIXELS = 0;
+// max total bytes of the live blobs. 0 is unlimited.
+static size_t LIMIT_BYTES = 0;
+static size_t LIVE_BYTES = 0;
+
+
+// check the number of pixels of the source image
+static int admit_pixels( int w, int h )
+{
+    size_t max_pixels = __atomic_load_n( &LIMIT_PIXELS, __ATOMIC_RELAXED );
+    
+    if( max_pixels && (size_t)w * (size_t)h > max_pixels ){
+        errno = E2BIG;
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+// reserve the blob bytes of the image before allocating it
+int blob_reserve( int w, int h )
+{
+    size_t bytes = sizeof( DATA32 ) * (size_t)w * (size_t)h;
+    size_t max_bytes = __atomic_load_n( &LIMIT_BYTES, __ATOMIC_RELAXED );
+    size_t live = __atomic_load_n( &LIVE_BYTES, __ATOMIC_RELAXED );
+    
+    if( admit_pixels( w, h ) != 0 ){
+        return -1;
+    }
+    
+    do {
+        if( max_bytes && ( bytes > max_bytes || live > max_bytes - bytes ) ){
+            errno = ENOMEM;
+            return -1;
+        }
+    } while( !__atomic_compare_exchange_n( &LIVE_BYTES, &live, live + bytes, 
+                                           0, __ATOMIC_RELAXED, 
+                                           __ATOMIC_RELAXED ) );
+    
+    return 0;
+}
+
+
+void blob_release( size_t bytes )
+{
+    __atomic_sub_fetch( &LIVE_BYTES, bytes, __ATOMIC_RELAXED );
+}
+
+
+void img_limits_get( img_limits_t *lim )
+{
+    lim->pixels = __atomic_load_n( &LIMIT_PIXELS, __ATOMIC_RELAXED );
+    lim->bytes = __atomic_load_n( &LIMIT_BYTES, __ATOMIC_RELAXED );
+    lim->live = __atomic_load_n( &LIVE_BYTES, __ATOMIC_RELAXED );
+}
+
+
+void img_limits_set( size_t pixels, size_t bytes )
+{
+    __atomic_store_n( &LIMIT_PIXELS, pixels, __ATOMIC_RELAXED );
+    __atomic_store_n( &LIMIT_BYTES, bytes, __ATOMIC_RELAXED );
+}
+
+
+void img_init( img_t *img, void *blob, int w, int h )
+{
+    img->njob = 0;
+    img->nrun = 0;
+    img->release = 0;
+    img->digested = 0;
+    img->borrowed = 0;
+    img->shared = NULL;
+    img->imimg = NULL;
+    img->blob = blob;
+    img->size = (img_size_t){ w, h };
+    img->orig = img->size;
+    img->bytes = sizeof( DATA32 ) * (size_t)w * (size_t)h;
+    img->quality = 100;
+    img->filter = RESAMPLE_IMLIB;
+    img->resize = (img_size_t){ 0, 0 };
+}
+
+
+// take ownership of imimg and use its pixels as the blob without copying
+static int img_load_imlib( img_t *img, Imlib_Image imimg )
+{
+    char *format = NULL;
+    DATA32 *blob = NULL;
+    int w = 0;
+    int h = 0;
+    
+    imlib_context_set_image( imimg );
+    format = imlib_image_format();
+    w = imlib_image_get_width();
+    h = imlib_image_get_height();
+    // pixels are decoded lazily by the following data access
+    if( img_format_copy( img, format, strlen( format ) ) == 0 && 
+        blob_reserve( w, h ) == 0 )
+    {
+        if( ( blob = imlib_image_get_data_for_reading_only() ) ){
+            img_init( img, blob, w, h );
+            img->imimg = imimg;
+            // render as opaque image as well as the image that wraps the blob
+            imlib_image_set_has_alpha( 0 );
+            return 0;
+        }
+        blob_release( sizeof( DATA32 ) * (size_t)w * (size_t)h );
+    }
+    imlib_free_image_and_decache();
+    
+    return -1;
+}
+
+
+static void pixels_retain( void *arg )
+{
+    __atomic_add_fetch( &((img_pixels_t*)arg)->ref, 1, __ATOMIC_RELAXED );
+}
+
+
+static void pixels_release( void *arg )
+{
+    img_pixels_t *px = (img_pixels_t*)arg;
+    
+    if( __atomic_sub_fetch( &px->ref, 1, __ATOMIC_ACQ_REL ) == 0 )
+    {
+        if( px->imimg ){
+            IMLIB_LOCK();
+            imlib_context_set_image( px->imimg );
+            imlib_free_image_and_decache();
+            IMLIB_UNLOCK();
+        }
+        else {
+            bufpool_free( px->blob, px->bytes );
+        }
+        blob_release( px->bytes );
+        free( px );
+    }
+}
+
+
+// move the ownership of the blob to the shared pixels
+static int img_share( img_t *img )
+{
+    img_pixels_t *px = NULL;
+    
+    if( img->shared ){
+        return 0;
+    }
+    else if( !( px = malloc( sizeof( img_pixels_t ) ) ) ){
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    *px = (img_pixels_t){
+        .ref = 1,
+        .imimg = img->imimg,
+        .blob = img->blob,
+        .bytes = img->bytes,
+        .size = img->size,
+        .orig = img->orig
+    };
+    memcpy( px->format, img->format, MAX_FORMAT_LEN );
+    img->shared = px;
+    
+    return 0;
+}
+
+
+// create the image that refers to the retained shared pixels
+static void img_load_shared( img_t *img, img_pixels_t *px )
+{
+    img_init( img, px->blob, px->size.w, px->size.h );
+    img->shared = px;
+    img->imimg = px->imimg;
+    img->orig = px->orig;
+    memcpy( img->format, px->format, MAX_FORMAT_LEN );
+}
+
+
+void img_dispose( img_t *img )
+{
+    if( img->shared ){
+        pixels_release( img->shared );
+        img->shared = NULL;
+        img->imimg = NULL;
+        img->blob = NULL;
+    }
+    else if( img->imimg ){
+        IMLIB_LOCK();
+        imlib_context_set_image( img->imimg );
+        imlib_free_image_and_decache();
+        IMLIB_UNLOCK();
+        img->imimg = NULL;
+    }
+    // blob is not allocated by this image
+    else if( img->borrowed ){
+        img->borrowed = 0;
+        img->blob = NULL;
+    }
+    else if( img->blob ){
+        bufpool_free( img->blob, img->bytes );
+    }
+    if( img->blob ){
+        blob_release( img->bytes );
+        img->blob = NULL;
+    }
+}
+
+
+// returns the image that can be used as the source of rendering.
+// it must be released by img_unwrap.
+Imlib_Image img_wrap( img_t *img )
+{
+    Imlib_Image src = img->imimg;
+    uint64_t start = 0;
+    
+    if( !src ){
+        start = stats_now();
+        IMLIB_LOCK();
+        src = imlib_create_image_using_data( img->size.w, img->size.h, 
+                                             img->blob );
+        IMLIB_UNLOCK();
+        stats_stage( STATS_WRAP, start );
+    }
+    
+    return src;
+}
+
+
+void img_unwrap( img_t *img, Imlib_Image src )
+{
+    // release wrapper of blob
+    if( src != img->imimg ){
+        IMLIB_LOCK();
+        imlib_context_set_image( src );
+        imlib_free_image();
+        IMLIB_UNLOCK();
+    }
+}
+
+
+// create the image of w x h that renders into the pooled buffer
+static Imlib_Image canvas_new( int w, int h )
+{
+    size_t bytes = sizeof( DATA32 ) * (size_t)w * (size_t)h;
+    DATA32 *data = bufpool_alloc( bytes );
+    Imlib_Image work = NULL;
+    
+    if( data && !( work = imlib_create_image_using_data( w, h, data ) ) ){
+        bufpool_free( data, bytes );
+    }
+    
+    return work;
+}
+
+
+// free the current image that created by canvas_new
+static void canvas_free( void )
+{
+    DATA32 *data = imlib_image_get_data_for_reading_only();
+    size_t bytes = sizeof( DATA32 ) * (size_t)imlib_image_get_width() * 
+                   (size_t)imlib_image_get_height();
+    
+    // imlib2 does not free the data of the image
+    imlib_free_image_and_decache();
+    bufpool_free( data, bytes );
+}
+
+
+// load the encoded data by imlib2 loaders
+static int img_load_mem( img_t *img, const void *data, size_t len, 
+                         const char *hint )
+{
+    Imlib_Image imimg = NULL;
+#if defined(IMLIB2_VERSION) && IMLIB2_VERSION >= 10800
+    char name[MAX_FORMAT_LEN + 8];
+    int rc = -1;
+    
+    // loader will be selected by the extension of name
+    snprintf( name, sizeof( name ), "buffer.%s", hint ? hint : "" );
+    IMLIB_LOCK();
+    if( ( imimg = imlib_load_image_mem( name, data, len ) ) ){
+        rc = img_load_imlib( img, imimg );
+    }
+    else {
+        errno = EINVAL;
+    }
+    IMLIB_UNLOCK();
+    
+    return rc;
+#else
+    // loaders of older imlib2 can read only from the file
+    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
+    FILE *fp = tmpfile();
+    char path[32];
+    int rc = -1;
+    
+    (void)hint;
+    if( fp )
+    {
+        if( fwrite( data, 1, len, fp ) == len && fflush( fp ) == 0 )
+        {
+            snprintf( path, sizeof( path ), "/dev/fd/%d", fileno( fp ) );
+            IMLIB_LOCK();
+            if( ( imimg = imlib_load_image_with_error_return( path, &err ) ) ){
+                rc = img_load_imlib( img, imimg );
+            }
+            else {
+                liberr2errno( err );
+            }
+            IMLIB_UNLOCK();
+        }
+        fclose( fp );
+    }
+    
+    return rc;
+#endif
+}
+
+
+// returns 1 if the embedded EXIF thumbnail of the image covers the hint size 
+// and has the same aspect ratio as the image.
+static int exif_thumbnail( probe_info_t *thumb, const probe_info_t *info, 
+                           const uint8_t *data, const codec_hint_t *hint )
+{
+    uint64_t a = 0;
+    uint64_t b = 0;
+    
+    if( !info->thumb_len || ( hint->w < 1 && hint->h < 1 ) || 
+        probe_mem( thumb, data + info->thumb_off, info->thumb_len ) != 0 || 
+        strcmp( thumb->format, "jpeg" ) != 0 || 
+        thumb->w < hint->w || thumb->h < hint->h ){
+        return 0;
+    }
+    
+    // the thumbnail may be letterboxed into the fixed size. allow the 
+    // difference within a pixel of the thumbnail.
+    a = (uint64_t)thumb->w * (uint64_t)info->h;
+    b = (uint64_t)thumb->h * (uint64_t)info->w;
+    
+    return ( a > b ? a - b : b - a ) <= 
+           (uint64_t)( info->w > info->h ? info->w : info->h );
+}
+
+
+// apply the EXIF orientation to the decoded image. the orientations that 
+// swap the axes need the second buffer while transposing, so it is reserved 
+// as well as the decoded image.
+static int img_orient( codec_img_t *dec, int orientation )
+{
+    int rc = 0;
+    
+    if( orientation < 5 ){
+        return codec_orient( dec, orientation );
+    }
+    else if( blob_reserve( dec->h, dec->w ) != 0 ){
+        return -1;
+    }
+    rc = codec_orient( dec, orientation );
+    blob_release( sizeof( DATA32 ) * (size_t)dec->w * (size_t)dec->h );
+    
+    return rc;
+}
+
+
+int img_load_buffer( img_t *img, const void *data, size_t len, 
+                     const char *format, const codec_hint_t *hint )
+{
+    const char *sniffed = codec_sniff( data, len );
+    probe_info_t info;
+    probe_info_t thumb;
+    codec_hint_t stored = *hint;
+    codec_img_t dec;
+    img_size_t orig;
+    size_t bytes = 0;
+    int orientation = 1;
+    
+    if( sniffed ){
+        format = sniffed;
+    }
+    // decode by native decoder
+    if( format && codec_can_decode( format ) )
+    {
+        if( probe_mem( &info, data, len ) != 0 ){
+            return -1;
+        }
+        // hint size of the stored orientation
+        else if( hint->orient && ( orientation = info.orientation ) >= 5 ){
+            stored.w = hint->h;
+            stored.h = hint->w;
+        }
+        orig = (img_size_t){ info.w, info.h };
+        // decode the embedded thumbnail instead of the image
+        if( hint->thumbnail && 
+            exif_thumbnail( &thumb, &info, data, &stored ) ){
+            data = (const uint8_t*)data + info.thumb_off;
+            len = info.thumb_len;
+            info = thumb;
+        }
+        // check the pixels of the source, and reserve the bytes of full 
+        // size image, or the reduced size image of streaming decode before 
+        // decoding
+        if( admit_pixels( info.w, info.h ) != 0 ){
+            return -1;
+        }
+        else if( stored.stream && 
+                 codec_can_stream( data, len, info.format ) ){
+            codec_cover_size( &info.w, &info.h, info.w, info.h, &stored );
+        }
+        else {
+            stored.stream = 0;
+        }
+        if( blob_reserve( info.w, info.h ) != 0 ){
+            return -1;
+        }
+        bytes = sizeof( DATA32 ) * (size_t)info.w * (size_t)info.h;
+        if( codec_decode( &dec, data, len, info.format, &stored ) == 0 )
+        {
+            dec.orig_w = orig.w;
+            dec.orig_h = orig.h;
+            if( img_orient( &dec, orientation ) == 0 && 
+                img_format_copy( img, format, strlen( format ) ) == 0 ){
+                img_init( img, dec.pixels, dec.w, dec.h );
+                img->orig = (img_size_t){ dec.orig_w, dec.orig_h };
+                // release the bytes that reduced by scaled decoding
+                if( bytes > img->bytes ){
+                    blob_release( bytes - img->bytes );
+                }
+                return 0;
+            }
+            bufpool_free( dec.pixels, sizeof( DATA32 ) * (size_t)dec.w * 
+                                      (size_t)dec.h );
+        }
+        blob_release( bytes );
+        return -1;
+    }
+    
+    return img_load_mem( img, data, len, format );
+}
+
+
+// decode the jpeg file by native decoder at reduced size or in the EXIF 
+// orientation, or the file of native format by streaming decode.
+// returns 1 if the file is not decoded by native decoder.
+static int img_load_scaled( img_t *img, const char *path, 
+                            const codec_hint_t *hint )
+{
+    struct stat st;
+    void *data = MAP_FAILED;
+    int fd = open( path, O_RDONLY|O_CLOEXEC );
+    int rc = -1;
+    
+    if( fd != -1 )
+    {
+        if( fstat( fd, &st ) == 0 )
+        {
+            if( S_ISDIR( st.st_mode ) ){
+                errno = EISDIR;
+            }
+            else if( st.st_size == 0 ){
+                errno = EINVAL;
+            }
+            else if( ( data = mmap( NULL, (size_t)st.st_size, PROT_READ, 
+                                    MAP_PRIVATE, fd, 0 ) ) != MAP_FAILED ){
+                const char *format = codec_sniff( data, (size_t)st.st_size );
+                
+                if( format && ( strcmp( format, "jpeg" ) == 0 || 
+                                ( hint->stream && 
+                                  codec_can_decode( format ) ) ) ){
+                    rc = img_load_buffer( img, data, (size_t)st.st_size, 
+                                          format, hint );
+                }
+                else {
+                    rc = 1;
+                }
+                munmap( data, (size_t)st.st_size );
+            }
+        }
+        close( fd );
+    }
+    
+    return rc;
+}
+
+
+int img_load( img_t *img, const char *path, const codec_hint_t *hint )
+{
+    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
+    Imlib_Image imimg = NULL;
+    int rc = 0;
+    
+    if( ( hint->w > 0 || hint->h > 0 || hint->stream || hint->orient ) && 
+        ( rc = img_load_scaled( img, path, hint ) ) != 1 ){
+        return rc;
+    }
+    
+    IMLIB_LOCK();
+    if( ( imimg = imlib_load_image_with_error_return( path, &err ) ) ){
+        rc = img_load_imlib( img, imimg );
+    }
+    else {
+        liberr2errno( err );
+        rc = -1;
+    }
+    IMLIB_UNLOCK();
+    
+    return rc;
+}
+
+
+// create the image by converting the raw pixels
+int img_read( img_t *img, int w, int h, const void *data, size_t stride, 
+              int fmt )
+{
+    if( blob_reserve( w, h ) != 0 ){
+        return -1;
+    }
+    
+    img_init( img, NULL, w, h );
+    if( !( img->blob = bufpool_alloc( img->bytes ) ) ){
+        blob_release( img->bytes );
+        errno = ENOMEM;
+        return -1;
+    }
+    // use default file format
+    img_format_copy( img, DEFAULT_FORMAT, sizeof( DEFAULT_FORMAT ) );
+    codec_raw_convert( img->blob, data, w, h, stride, fmt );
+    if( outcache_enabled() ){
+        img_digest_pixels( img );
+    }
+    
+    return 0;
+}
+
+
+// create the image that refers to the native pixels without copying
+int img_read_borrowed( img_t *img, int w, int h, void *pixels )
+{
+    img_init( img, pixels, w, h );
+    img->borrowed = 1;
+    // use default file format
+    img_format_copy( img, DEFAULT_FORMAT, sizeof( DEFAULT_FORMAT ) );
+    if( outcache_enabled() ){
+        img_digest_pixels( img );
+    }
+    
+    return 0;
+}
+
+
+// MARK: output file
+static unsigned int TMP_SEQ = 0;
+
+// temporary path next to path that is renamed to path after written.
+// the destination may be the hard link to the file of the output cache, so 
+// it must be replaced instead of written in place.
+static int tmp_path( char *tmp, size_t len, const char *path )
+{
+    int n = snprintf( tmp, len, "%s.%d.%u.tmp", path, (int)getpid(), 
+                      __atomic_add_fetch( &TMP_SEQ, 1, __ATOMIC_RELAXED ) );
+    
+    if( n < 0 || (size_t)n >= len ){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+// rename tmp to path if rc is 0, or remove tmp
+static int tmp_commit( const char *tmp, const char *path, int rc )
+{
+    int errnum = 0;
+    
+    if( rc == 0 && ( rc = rename( tmp, path ) ) == 0 ){
+        return 0;
+    }
+    errnum = errno;
+    unlink( tmp );
+    errno = errnum;
+    
+    return -1;
+}
+
+
+// save current image to path by imlib2 saver and release it
+static int save2path( const char *path, uint8_t quality, const char *format )
+{
+    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
+    char tmp[PATH_MAX + 32];
+    int rc = tmp_path( tmp, sizeof( tmp ), path );
+    
+    if( rc == 0 )
+    {
+        // set quality
+        imlib_image_attach_data_value( "quality", NULL, quality, NULL );
+        imlib_image_set_format( format );
+        imlib_save_image_with_error_return( tmp, &err );
+        if( err ){
+            liberr2errno( err );
+            rc = -1;
+        }
+        rc = tmp_commit( tmp, path, rc );
+    }
+    canvas_free();
+    
+    return rc;
+}
+
+
+// save current image via temporary file and read it back into buf
+static int save2tmp( membuf_t *buf, uint8_t quality, const char *format )
+{
+    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
+    FILE *fp = tmpfile();
+    char path[32];
+    int rc = -1;
+    
+    if( fp )
+    {
+        snprintf( path, sizeof( path ), "/dev/fd/%d", fileno( fp ) );
+        imlib_image_attach_data_value( "quality", NULL, quality, NULL );
+        imlib_image_set_format( format );
+        imlib_save_image_with_error_return( path, &err );
+        if( err ){
+            liberr2errno( err );
+        }
+        else if( lseek( fileno( fp ), 0, SEEK_SET ) == 0 ){
+            rc = membuf_read( buf, fileno( fp ) );
+        }
+        fclose( fp );
+    }
+    
+    return rc;
+}
+
+
+// encode the current image into buf and release it.
+// IMLIB_MUTEX must be held, and it is released while encoding natively.
+static int encode2buf( membuf_t *buf, uint8_t quality, const char *format, 
+                       const codec_opts_t *opts )
+{
+    Imlib_Image work = imlib_context_get_image();
+    int rc = 0;
+    
+    if( codec_is_native( format ) ){
+        codec_src_t src = {
+            .pixels = imlib_image_get_data_for_reading_only(),
+            .w = imlib_image_get_width(),
+            .h = imlib_image_get_height(),
+            .alpha = imlib_image_has_alpha(),
+            .quality = quality,
+            .opts = opts
+        };
+        // work image is not shared with other threads
+        IMLIB_UNLOCK();
+        rc = codec_encode( buf, &src, format );
+        IMLIB_LOCK();
+        imlib_context_set_image( work );
+    }
+    // fallback to imlib2 saver
+    else {
+        rc = save2tmp( buf, quality, format );
+    }
+    canvas_free();
+    
+    return rc;
+}
+
+
+static int write2path( membuf_t *buf, const char *path )
+{
+    char tmp[PATH_MAX + 32];
+    int fd = -1;
+    int rc = -1;
+    
+    if( tmp_path( tmp, sizeof( tmp ), path ) == 0 && 
+        ( fd = open( tmp, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0666 ) ) != -1 )
+    {
+        rc = membuf_write( buf, fd );
+        if( close( fd ) != 0 && rc == 0 ){
+            rc = -1;
+        }
+        rc = tmp_commit( tmp, path, rc );
+    }
+    
+    return rc;
+}
+
+
+// calculate bounds of source image that cropped by aspect ratio of resize
+static void bounds_crop( img_bounds_t *bounds, img_size_t size, 
+                         img_spec_t *spec )
+{
+    double aspect_org = (double)size.w/(double)size.h;
+    double aspect = (double)spec->resize.w/(double)spec->resize.h;
+    uint8_t align = IMG_ALIGN_NONE;
+    
+    *bounds = (img_bounds_t){ 0, 0, 0, 0 };
+    // based on height
+    if( aspect_org > aspect ){
+        bounds->h = size.h;
+        bounds->w = (int)((double)size.h * aspect);
+        align = spec->halign;
+    }
+    // based on width
+    else if( aspect_org < aspect ){
+        bounds->w = size.w;
+        bounds->h = (int)((double)size.w / aspect);
+        align = spec->valign;
+    }
+    // square
+    else {
+        bounds->w = size.w;
+        bounds->h = size.h;
+    }
+    // calculate bounds position
+    BOUNDS_ALIGN( (*bounds), align, size );
+}
+
+
+// calculate bounds of image with maintaining aspect ratio in resize
+static void bounds_aspect( img_bounds_t *bounds, img_size_t size, 
+                           img_spec_t *spec )
+{
+    double aspect_org = (double)size.w/(double)size.h;
+    double aspect = (double)spec->resize.w/(double)spec->resize.h;
+    uint8_t align = IMG_ALIGN_NONE;
+    
+    *bounds = (img_bounds_t){ 0, 0, 0, 0 };
+    // based on width
+    if( aspect_org > aspect ){
+        bounds->w = spec->resize.w;
+        bounds->h = (int)((double)bounds->w / aspect_org);
+        align = spec->valign;
+    }
+    // based on height
+    else if( aspect_org < aspect ){
+        bounds->h = spec->resize.h;
+        bounds->w = (int)((double)bounds->h * aspect_org);
+        align = spec->halign;
+    }
+    // square
+    else {
+        bounds->w = spec->resize.w;
+        bounds->h = spec->resize.h;
+    }
+    // calculate bounds position
+    BOUNDS_ALIGN( (*bounds), align, spec->resize );
+}
+
+
+// MARK: banded rendering
+// min number of pixels to render by multiple threads
+#define BAND_MIN_PIXELS     ( 1 << 20 )
+
+static int NTHREADS = 1;
+// set on the workers of the batch export, that render the bands inline
+static __thread int BATCH_WORKER = 0;
+
+typedef int (*band_fn)( void *ctx, int y0, int y1 );
+
+
+int img_threads( int n )
+{
+    if( n > 0 ){
+        __atomic_store_n( &NTHREADS, n, __ATOMIC_RELAXED );
+    }
+    
+    return __atomic_load_n( &NTHREADS, __ATOMIC_RELAXED );
+}
+
+
+typedef struct {
+    band_fn fn;
+    void *ctx;
+    int y0;
+    int y1;
+    int rc;
+    int errnum;
+} band_t;
+
+
+static void *band_run( void *arg )
+{
+    band_t *band = (band_t*)arg;
+    
+    band->rc = band->fn( band->ctx, band->y0, band->y1 );
+    band->errnum = errno;
+    
+    return NULL;
+}
+
+
+// split the rows into bands and render them in parallel. the result must 
+// not depend on the number of bands.
+// returns 0 on success, or -1 on failure with errno.
+static int bands_run( band_fn fn, void *ctx, int h, size_t pixels )
+{
+    int n = __atomic_load_n( &NTHREADS, __ATOMIC_RELAXED );
+    band_t bands[BAND_MAX_THREADS];
+    pthread_t threads[BAND_MAX_THREADS];
+    uint8_t joinable[BAND_MAX_THREADS];
+    int i = 0;
+    
+    if( n > h ){
+        n = h;
+    }
+    if( n < 2 || pixels < BAND_MIN_PIXELS || BATCH_WORKER ){
+        return fn( ctx, 0, h );
+    }
+    
+    for(; i < n; i++ ){
+        bands[i] = (band_t){ 
+            fn, ctx, (int)( (int64_t)h * i / n ), 
+            (int)( (int64_t)h * ( i + 1 ) / n ), 0, 0 
+        };
+    }
+    // render the first band on the calling thread
+    for( i = 1; i < n; i++ )
+    {
+        joinable[i] = pthread_create( &threads[i], NULL, band_run, 
+                                      &bands[i] ) == 0;
+        if( !joinable[i] ){
+            band_run( &bands[i] );
+        }
+    }
+    band_run( &bands[0] );
+    for( i = 1; i < n; i++ ){
+        if( joinable[i] ){
+            pthread_join( threads[i], NULL );
+        }
+    }
+    
+    for( i = 0; i < n; i++ ){
+        if( bands[i].rc != 0 ){
+            errno = bands[i].errnum;
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+
+// MARK: compositor
+typedef struct {
+    resample_t r;
+    DATA32 *dst;
+    // size of the canvas
+    int w;
+    int h;
+    // position of the scaled image in the canvas
+    img_bounds_t frame;
+    DATA32 color;
+} compose_t;
+
+
+static inline void fill_row( DATA32 *row, int w, DATA32 color )
+{
+    int x = 0;
+    
+    for(; x < w; x++ ){
+        row[x] = color;
+    }
+}
+
+
+// fill the margins with the background color and resample the source into 
+// the frame. each pixel of the canvas is written only once.
+static int band_compose( void *ctx, int y0, int y1 )
+{
+    compose_t *c = (compose_t*)ctx;
+    img_bounds_t *f = &c->frame;
+    int top = y0 > f->y ? y0 : f->y;
+    int bottom = y1 < f->y + f->h ? y1 : f->y + f->h;
+    int y = y0;
+    
+    for(; y < y1; y++ )
+    {
+        DATA32 *row = c->dst + (size_t)c->w * (size_t)y;
+        
+        if( y < f->y || y >= f->y + f->h ){
+            fill_row( row, c->w, c->color );
+        }
+        else {
+            fill_row( row, f->x, c->color );
+            fill_row( row + f->x + f->w, c->w - f->x - f->w, c->color );
+        }
+    }
+    
+    if( top < bottom ){
+        return resample_rows( &c->r, top - f->y, bottom - f->y );
+    }
+    
+    return 0;
+}
+
+
+// fill the margins of the canvas by imlib2
+static void fill_margins( int w, int h, img_bounds_t *f )
+{
+    imlib_image_fill_rectangle( 0, 0, w, f->y );
+    imlib_image_fill_rectangle( 0, f->y + f->h, w, h - f->y - f->h );
+    imlib_image_fill_rectangle( 0, f->y, f->x, f->h );
+    imlib_image_fill_rectangle( f->x + f->w, f->y, w - f->x - f->w, f->h );
+}
+
+
+// scale the area of the source image into the frame of the new image of 
+// w x h, and fill the rest of the new image with the background color.
+static Imlib_Image compose_area( img_t *img, Imlib_Image src, 
+                                 img_spec_t *spec, img_bounds_t area, 
+                                 int w, int h, img_bounds_t frame )
+{
+    int margins = frame.w < w || frame.h < h;
+    Imlib_Image work = canvas_new( w, h );
+    compose_t c = {
+        .w = w,
+        .h = h,
+        .frame = frame
+    };
+    int blend = 0;
+    int r, g, b, a;
+    int rc = 0;
+    
+    if( !work ){
+        return NULL;
+    }
+    
+    imlib_context_set_image( work );
+    imlib_context_set_color_hlsa( spec->hue, spec->lightness, 
+                                  spec->saturation, spec->alpha );
+    if( spec->filter == RESAMPLE_IMLIB )
+    {
+        // blend only if the source has the alpha channel
+        if( margins ){
+            imlib_context_set_image( src );
+            blend = imlib_image_has_alpha();
+            imlib_context_set_image( work );
+        }
+        if( blend ){
+            imlib_image_fill_rectangle( 0, 0, w, h );
+        }
+        else if( margins ){
+            fill_margins( w, h, &frame );
+        }
+        imlib_context_set_blend( blend );
+        imlib_blend_image_onto_image( src, 0, area.x, area.y, area.w, 
+                                      area.h, frame.x, frame.y, frame.w, 
+                                      frame.h );
+        imlib_context_set_blend( 1 );
+        return work;
+    }
+    
+    imlib_context_get_color( &r, &g, &b, &a );
+    c.color = (DATA32)a << 24 | (DATA32)r << 16 | (DATA32)g << 8 | (DATA32)b;
+    // opaque as well as the image that scaled by imlib2
+    imlib_image_set_has_alpha( 0 );
+    c.dst = imlib_image_get_data();
+    // work image is not shared with other threads
+    IMLIB_UNLOCK();
+    if( ( rc = resample_init( &c.r, 
+                              c.dst + (size_t)w * (size_t)frame.y + frame.x, 
+                              w, frame.w, frame.h, img->blob, img->size.w, 
+                              area.x, area.y, area.w, area.h, 
+                              spec->filter ) ) == 0 ){
+        rc = bands_run( band_compose, &c, h, (size_t)area.w * 
+                        (size_t)area.h + (size_t)w * (size_t)h );
+        resample_dispose( &c.r );
+    }
+    IMLIB_LOCK();
+    imlib_context_set_image( work );
+    imlib_image_put_back_data( c.dst );
+    if( rc != 0 ){
+        canvas_free();
+        return NULL;
+    }
+    
+    return work;
+}
+
+
+// render the thumbnail of src image by spec and return it as current image
+static Imlib_Image img_render( img_t *img, Imlib_Image src, img_spec_t *spec )
+{
+    img_bounds_t area = { 0, 0, img->size.w, img->size.h };
+    img_bounds_t frame = { 0, 0, spec->resize.w, spec->resize.h };
+    img_size_t canvas = spec->resize;
+    Imlib_Image work = NULL;
+    uint64_t start = stats_now();
+    
+    if( spec->resize.w < 1 || spec->resize.h < 1 ){
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    switch( spec->mode )
+    {
+        case IMG_MODE_CROP:
+            bounds_crop( &area, img->size, spec );
+        break;
+        
+        case IMG_MODE_TRIM:
+            bounds_aspect( &frame, img->size, spec );
+            canvas = (img_size_t){ frame.w, frame.h };
+            frame.x = frame.y = 0;
+        break;
+        
+        // letterbox
+        case IMG_MODE_ASPECT:
+            bounds_aspect( &frame, img->size, spec );
+        break;
+    }
+    
+    work = compose_area( img, src, spec, area, canvas.w, canvas.h, frame );
+    stats_stage( spec->mode == IMG_MODE_ASPECT ? STATS_COMPOSE : STATS_SCALE, 
+                 start );
+    if( work ){
+        imlib_context_set_image( work );
+    }
+    else {
+        errno = ENOMEM;
+    }
+    
+    return work;
+}
+
+
+// MARK: output cache
+static inline uint64_t hash_mix( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    
+    return h;
+}
+
+
+// 128-bit hash of the content. this is not a cryptographic hash.
+static void content_hash( const uint8_t *data, size_t len, uint64_t h[2] )
+{
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t h2 = 0xc2b2ae3d27d4eb4fULL + len;
+    uint64_t w = 0;
+    size_t i = 0;
+    
+    for(; i + 8 <= len; i += 8 ){
+        memcpy( &w, data + i, 8 );
+        h1 = ( h1 ^ w ) * 0x87c37b91114253d5ULL;
+        h1 ^= h1 >> 29;
+        h2 = ( h2 + w ) * 0x4cf5ad432745937fULL;
+        h2 = ( h2 << 31 ) | ( h2 >> 33 );
+    }
+    if( i < len ){
+        w = 0;
+        memcpy( &w, data + i, len - i );
+        h1 = ( h1 ^ w ) * 0x87c37b91114253d5ULL;
+        h2 = ( h2 + w ) * 0x4cf5ad432745937fULL;
+    }
+    h[0] = hash_mix( h1 ^ h2 );
+    h[1] = hash_mix( h2 + h[0] );
+}
+
+
+// set the digest of the source by the key string or the data
+void img_digest( img_t *img, const void *data, size_t len )
+{
+    content_hash( (const uint8_t*)data, len, img->digest );
+    img->digested = 1;
+}
+
+
+// set the digest of the source by the pixels and the size
+void img_digest_pixels( img_t *img )
+{
+    img_digest( img, img->blob, img->bytes );
+    img->digest[0] = hash_mix( img->digest[0] ^ (uint64_t)img->size.w );
+    img->digest[1] = hash_mix( img->digest[1] ^ (uint64_t)img->size.h );
+}
+
+
+// key of the output by the digest of the source and the export parameters
+static int img_outcache_key( char *key, img_t *img, img_spec_t *spec, 
+                             uint8_t quality, const char *format )
+{
+    char str[256];
+    uint64_t h[2];
+    int len = 0;
+    
+    if( !img->digested || !outcache_enabled() ){
+        return -1;
+    }
+    len = snprintf( str, sizeof( str ), 
+                    "%016llx%016llx:%dx%d:%d:%d:%d:%d:%a:%a:%a:%d:%d:%s:"
+                    "%d:%d:%d:%d:%d:%d:%d:%zu", 
+                    (unsigned long long)img->digest[0], 
+                    (unsigned long long)img->digest[1], 
+                    spec->resize.w, spec->resize.h, spec->mode, spec->halign, 
+                    spec->valign, spec->filter, (double)spec->hue, 
+                    (double)spec->saturation, (double)spec->lightness, 
+                    spec->alpha, quality, format, spec->enc.subsampling, 
+                    spec->enc.progressive, spec->enc.optimize, spec->enc.dct, 
+                    spec->enc.level, spec->enc.filter, spec->enc.lossless, 
+                    spec->enc.max_bytes );
+    if( len < 0 || (size_t)len >= sizeof( str ) ){
+        return -1;
+    }
+    content_hash( (const uint8_t*)str, (size_t)len, h );
+    snprintf( key, OUTCACHE_KEY_LEN, "%016llx%016llx", 
+              (unsigned long long)h[0], (unsigned long long)h[1] );
+    
+    return 0;
+}
+
+
+// copy the cached output to the destination. returns 0 on success, 1 if 
+// not cached, or -1 on failure with errno.
+static int save_cached( const char *key, img_dest_t *dest, membuf_t *out )
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 32];
+    size_t len = out->len;
+    int fd = -1;
+    int rc = 0;
+    
+    if( outcache_get( key, path, sizeof( path ) ) != 0 ){
+        return 1;
+    }
+    // link the cached file to the destination path and replace it
+    else if( dest->path && outcache_link() && 
+             tmp_path( tmp, sizeof( tmp ), dest->path ) == 0 && 
+             link( path, tmp ) == 0 ){
+        return tmp_commit( tmp, dest->path, 0 );
+    }
+    // removed by the other threads
+    else if( ( fd = open( path, O_RDONLY|O_CLOEXEC ) ) == -1 ){
+        return 1;
+    }
+    
+    rc = membuf_read( out, fd );
+    close( fd );
+    if( rc != 0 ){
+        out->len = len;
+    }
+    else if( !dest->buf ){
+        rc = dest->path ? write2path( out, dest->path ) : 
+                          membuf_write( out, dest->fd );
+    }
+    
+    return rc;
+}
+
+
+// MARK: export
+// encode the rendered current image into out and release it, and write it 
+// to path or fd if out is not the destination buffer. the output is stored 
+// to the output cache if key is not NULL.
+// IMLIB_MUTEX must be held, and it is released.
+static int output_spec( img_spec_t *spec, img_dest_t *dest, membuf_t *out, 
+                        uint8_t quality, const char *format, 
+                        const char *key )
+{
+    size_t len = out->len;
+    uint64_t t = 0;
+    int rc = 0;
+    
+    // save to path by imlib2 saver
+    if( dest->path && !codec_is_native( format ) && !key ){
+        t = stats_now();
+        rc = save2path( dest->path, quality, format );
+        stats_stage( STATS_ENCODE, t );
+        IMLIB_UNLOCK();
+        return rc;
+    }
+    
+    t = stats_now();
+    rc = encode2buf( out, quality, format, &spec->enc );
+    stats_stage( STATS_ENCODE, t );
+    IMLIB_UNLOCK();
+    if( rc == 0 && key ){
+        outcache_put( key, out->data + len, out->len - len );
+    }
+    if( rc == 0 && out != dest->buf ){
+        t = stats_now();
+        rc = dest->path ? write2path( out, dest->path ) : 
+                          membuf_write( out, dest->fd );
+        stats_stage( STATS_WRITE, t );
+    }
+    
+    return rc;
+}
+
+
+// render and encode the image into out, and write it to path or fd if 
+// out is not the destination buffer. the output is stored to the output 
+// cache if key is not NULL.
+static int render_spec( img_t *img, Imlib_Image src, img_spec_t *spec, 
+                        img_dest_t *dest, membuf_t *out, uint8_t quality, 
+                        const char *format, const char *key )
+{
+    IMLIB_LOCK();
+    if( !img_render( img, src, spec ) ){
+        IMLIB_UNLOCK();
+        return -1;
+    }
+    
+    return output_spec( spec, dest, out, quality, format, key );
+}
+
+
+int save_spec( img_t *img, Imlib_Image src, img_spec_t *spec, 
+               img_dest_t *dest, uint8_t quality, const char *format )
+{
+    uint64_t start = stats_now();
+    membuf_t buf;
+    // encode into memory, or encode into buf and write to path or fd
+    membuf_t *out = dest->buf ? dest->buf : &buf;
+    size_t len = out == &buf ? 0 : out->len;
+    char key[OUTCACHE_KEY_LEN];
+    int cached = img_outcache_key( key, img, spec, quality, format ) == 0;
+    int rc = 1;
+    int errnum = 0;
+    
+    membuf_init( &buf );
+    // skip rendering if the output is cached
+    if( !cached || ( rc = save_cached( key, dest, out ) ) == 1 ){
+        rc = render_spec( img, src, spec, dest, out, quality, format, 
+                          cached ? key : NULL );
+    }
+    
+    errnum = rc ? errno : 0;
+    stats_op( ( dest->buf ? STATS_ENCODE_STRETCH : STATS_SAVE ) + spec->mode, 
+              format, start, img->bytes, out->len - len, errnum );
+    membuf_dispose( &buf );
+    errno = errnum;
+    
+    return rc;
+}
+
+
+int img_export( img_t *img, img_spec_t *spec, img_dest_t *dest )
+{
+    Imlib_Image src = img_wrap( img );
+    int rc = save_spec( img, src, spec, dest, img->quality, img->format );
+    int errnum = errno;
+    
+    img_unwrap( img, src );
+    errno = errnum;
+    
+    return rc;
+}
+
+
+// MARK: batch export
+typedef struct {
+    img_t *img;
+    Imlib_Image src;
+    img_batch_t *items;
+    int nitem;
+    // index of the next item
+    int next;
+    // the items are exported by multiple workers
+    int parallel;
+} batch_t;
+
+
+static void *batch_worker( void *arg )
+{
+    batch_t *b = (batch_t*)arg;
+    img_batch_t *item = NULL;
+    int i = 0;
+    
+    // render the bands inline if the items are exported in parallel
+    BATCH_WORKER = b->parallel;
+    while( ( i = __atomic_fetch_add( &b->next, 1, __ATOMIC_RELAXED ) ) < 
+           b->nitem )
+    {
+        item = &b->items[i];
+        item->errnum = save_spec( b->img, b->src, &item->spec, &item->dest, 
+                                  item->quality, item->format ) ? errno : 0;
+    }
+    BATCH_WORKER = 0;
+    
+    return NULL;
+}
+
+
+void img_export_batch( img_t *img, img_batch_t *items, int nitem )
+{
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    // share the source image with all items
+    batch_t b = { img, img_wrap( img ), items, nitem, 0, 0 };
+    pthread_t threads[BAND_MAX_THREADS];
+    uint8_t joinable[BAND_MAX_THREADS];
+    int n = nitem;
+    int i = 1;
+    
+    // one worker per item up to the number of processors. the native 
+    // encoders of the workers run outside of IMLIB_MUTEX
+    if( ncpu > 0 && n > ncpu ){
+        n = (int)ncpu;
+    }
+    if( n > BAND_MAX_THREADS ){
+        n = BAND_MAX_THREADS;
+    }
+    // a single item is rendered by the bands of thumbnailer.threads()
+    b.parallel = n > 1;
+    // the calling thread is the first worker
+    for(; i < n; i++ ){
+        joinable[i] = pthread_create( &threads[i], NULL, batch_worker, 
+                                      &b ) == 0;
+    }
+    batch_worker( &b );
+    for( i = 1; i < n; i++ ){
+        if( joinable[i] ){
+            pthread_join( threads[i], NULL );
+        }
+    }
+    img_unwrap( img, b.src );
+}
+
+
+// MARK: atlas
+// copy the rendered current image into the cell of the atlas, and release 
+// it. IMLIB_MUTEX must be held.
+static void atlas_put( img_atlas_item_t *item, DATA32 *dst, int w, 
+                       img_bounds_t cell, img_spec_t *spec )
+{
+    const DATA32 *src = imlib_image_get_data_for_reading_only();
+    img_size_t size = { cell.w, cell.h };
+    img_bounds_t bounds = { 
+        0, 0, imlib_image_get_width(), imlib_image_get_height() 
+    };
+    int y = 0;
+    
+    // trimmed image is smaller than the cell
+    BOUNDS_ALIGN( bounds, spec->halign, size );
+    BOUNDS_ALIGN( bounds, spec->valign, size );
+    bounds.x += cell.x;
+    bounds.y += cell.y;
+    for(; y < bounds.h; y++ ){
+        memcpy( dst + (size_t)w * (size_t)( bounds.y + y ) + bounds.x, 
+                src + (size_t)bounds.w * (size_t)y, 
+                sizeof( DATA32 ) * (size_t)bounds.w );
+    }
+    item->bounds = bounds;
+    canvas_free();
+}
+
+
+int img_atlas( img_atlas_item_t *items, int nitem, int columns, 
+               img_batch_t *b )
+{
+    uint64_t start = stats_now();
+    img_bounds_t cell = { 0, 0, b->spec.resize.w, b->spec.resize.h };
+    membuf_t buf;
+    // encode into memory, or encode into buf and write to path or fd
+    membuf_t *out = b->dest.buf ? b->dest.buf : &buf;
+    size_t len = out == &buf ? 0 : out->len;
+    Imlib_Image atlas = NULL;
+    Imlib_Image src = NULL;
+    DATA32 *dst = NULL;
+    DATA32 color = 0;
+    size_t bytes = 0;
+    int r, g, bl, a;
+    int w = 0;
+    int h = 0;
+    int i = 0;
+    int rc = -1;
+    int errnum = 0;
+    
+    if( nitem < 1 || columns < 1 || cell.w < 1 || cell.h < 1 ){
+        errno = EINVAL;
+        return -1;
+    }
+    else if( columns > nitem ){
+        columns = nitem;
+    }
+    // size of the atlas
+    if( (int64_t)columns * cell.w > INT_MAX || 
+        (int64_t)( ( nitem + columns - 1 ) / columns ) * cell.h > INT_MAX ){
+        errno = ERANGE;
+        return -1;
+    }
+    w = columns * cell.w;
+    h = ( nitem + columns - 1 ) / columns * cell.h;
+    bytes = sizeof( DATA32 ) * (size_t)w * (size_t)h;
+    
+    membuf_init( &buf );
+    IMLIB_LOCK();
+    if( !( atlas = canvas_new( w, h ) ) ){
+        IMLIB_UNLOCK();
+        errno = ENOMEM;
+        goto DONE;
+    }
+    imlib_context_set_image( atlas );
+    imlib_context_set_color_hlsa( b->spec.hue, b->spec.lightness, 
+                                  b->spec.saturation, b->spec.alpha );
+    imlib_context_get_color( &r, &g, &bl, &a );
+    color = (DATA32)a << 24 | (DATA32)r << 16 | (DATA32)g << 8 | (DATA32)bl;
+    imlib_image_set_has_alpha( a < 255 );
+    dst = imlib_image_get_data();
+    IMLIB_UNLOCK();
+    // fill the cells that are not covered by the images
+    for( i = 0; i < h; i++ ){
+        fill_row( dst + (size_t)w * (size_t)i, w, color );
+    }
+    
+    for( i = 0; i < nitem; i++ )
+    {
+        cell.x = i % columns * cell.w;
+        cell.y = i / columns * cell.h;
+        src = img_wrap( items[i].img );
+        IMLIB_LOCK();
+        if( img_render( items[i].img, src, &b->spec ) ){
+            atlas_put( &items[i], dst, w, cell, &b->spec );
+            rc = 0;
+        }
+        else {
+            errnum = errno;
+            rc = -1;
+        }
+        IMLIB_UNLOCK();
+        img_unwrap( items[i].img, src );
+        if( rc != 0 ){
+            IMLIB_LOCK();
+            imlib_context_set_image( atlas );
+            imlib_image_put_back_data( dst );
+            canvas_free();
+            IMLIB_UNLOCK();
+            errno = errnum;
+            goto DONE;
+        }
+    }
+    
+    IMLIB_LOCK();
+    imlib_context_set_image( atlas );
+    imlib_image_put_back_data( dst );
+    rc = output_spec( &b->spec, &b->dest, out, b->quality, b->format, NULL );
+    
+DONE:
+    errnum = rc ? errno : 0;
+    stats_op( STATS_ATLAS, b->format, start, bytes, out->len - len, errnum );
+    membuf_dispose( &buf );
+    errno = errnum;
+    
+    return rc;
+}
+
+
+// MARK: image cache
+static cache_t *IMG_CACHE = NULL;
+static pthread_once_t IMG_CACHE_ONCE = PTHREAD_ONCE_INIT;
+// IMG_CACHE is created before the capacity is set
+static size_t IMG_CACHE_CAPACITY = 0;
+static const cache_ops_t IMG_CACHE_OPS = {
+    pixels_retain,
+    pixels_release,
+    NULL
+};
+
+
+static void img_cache_create( void )
+{
+    IMG_CACHE = cache_new( &IMG_CACHE_OPS );
+}
+
+
+int img_cache_enabled( void )
+{
+    return __atomic_load_n( &IMG_CACHE_CAPACITY, __ATOMIC_ACQUIRE ) > 0;
+}
+
+
+// key of the file by path, size and mtime
+int img_cache_key_path( char *key, const char *path, struct stat *st, 
+                        const codec_hint_t *hint )
+{
+#if defined(__APPLE__)
+    long nsec = st->st_mtimespec.tv_nsec;
+#else
+    long nsec = st->st_mtim.tv_nsec;
+#endif
+    int len = snprintf( key, CACHE_KEY_LEN, 
+                        "path:%llu:%llu:%lld:%lld.%09ld:%dx%d:%d:%d:%d:%s", 
+                        (unsigned long long)st->st_dev, 
+                        (unsigned long long)st->st_ino, 
+                        (long long)st->st_size, (long long)st->st_mtime, 
+                        nsec, hint->w, hint->h, hint->stream, hint->orient, 
+                        hint->thumbnail, path );
+    
+    return len > 0 && len < CACHE_KEY_LEN ? 0 : -1;
+}
+
+
+// key of the buffer by content
+int img_cache_key_buffer( char *key, const void *data, size_t len, 
+                          const char *format, const codec_hint_t *hint )
+{
+    uint64_t h[2];
+    int n = 0;
+    
+    content_hash( (const uint8_t*)data, len, h );
+    n = snprintf( key, CACHE_KEY_LEN, 
+                  "buffer:%zu:%016llx%016llx:%dx%d:%d:%d:%d:%s", 
+                  len, (unsigned long long)h[0], (unsigned long long)h[1], 
+                  hint->w, hint->h, hint->stream, hint->orient, 
+                  hint->thumbnail, format ? format : "" );
+    
+    return n > 0 && n < CACHE_KEY_LEN ? 0 : -1;
+}
+
+
+// returns 0 if the image is created by the cached pixels
+int img_cache_get( img_t *img, const char *key )
+{
+    img_pixels_t *px = (img_pixels_t*)cache_get( IMG_CACHE, key );
+    
+    if( px ){
+        img_load_shared( img, px );
+        return 0;
+    }
+    
+    return -1;
+}
+
+
+void img_cache_put( img_t *img, const char *key )
+{
+    if( img_share( img ) == 0 ){
+        cache_put( IMG_CACHE, key, img->shared, img->bytes );
+    }
+}
+
+
+int img_cache_resize( size_t bytes )
+{
+    pthread_once( &IMG_CACHE_ONCE, img_cache_create );
+    if( !IMG_CACHE ){
+        errno = ENOMEM;
+        return -1;
+    }
+    cache_resize( IMG_CACHE, bytes );
+    __atomic_store_n( &IMG_CACHE_CAPACITY, bytes, __ATOMIC_RELEASE );
+    
+    return 0;
+}
+
+
+int img_cache_stats( cache_stats_t *stats, int reset )
+{
+    pthread_once( &IMG_CACHE_ONCE, img_cache_create );
+    if( !IMG_CACHE ){
+        errno = ENOMEM;
+        return -1;
+    }
+    cache_stats( IMG_CACHE, stats, reset );
+    
+    return 0;
+}
+
+
+
+// MARK: pipeline
+static inline int run_cancelled( img_run_t *r )
+{
+    return __atomic_load_n( &r->cancel, __ATOMIC_RELAXED );
+}
+
+
+// close the output queue of the stage after the last thread of the stage
+static void run_exit( img_run_t *r, int stage )
+{
+    if( __atomic_sub_fetch( &r->live[stage], 1, __ATOMIC_ACQ_REL ) == 0 ){
+        queue_close( r->queues[stage] );
+    }
+}
+
+
+static void run_spec_done( img_run_t *r, img_run_spec_t *s )
+{
+    if( __atomic_sub_fetch( &s->item->pending, 1, __ATOMIC_ACQ_REL ) == 0 ){
+        queue_push( r->queues[IMG_RUN_ENCODE], s->item );
+    }
+}
+
+
+static void *run_decoder( void *arg )
+{
+    img_run_t *r = (img_run_t*)arg;
+    img_run_item_t *item = NULL;
+    uint64_t start = 0;
+    int op = 0;
+    int i = 0;
+    
+    while( !run_cancelled( r ) && 
+           ( i = __atomic_fetch_add( &r->next, 1, __ATOMIC_RELAXED ) ) < 
+           r->nitem )
+    {
+        item = &r->items[i];
+        op = item->path ? STATS_LOAD : STATS_LOAD_BUFFER;
+        start = stats_now();
+        if( ( item->path ? 
+              img_load( &item->img, item->path, &item->hint ) : 
+              img_load_buffer( &item->img, item->data, item->len, 
+                               item->format, &item->hint ) ) != 0 ){
+            item->errnum = errno;
+            stats_op( op, item->format, start, item->len, 0, item->errnum );
+            queue_push( r->queues[IMG_RUN_ENCODE], item );
+            continue;
+        }
+        stats_stage( STATS_DECODE, start );
+        stats_op( op, item->img.format, start, item->len, item->img.bytes, 0 );
+        item->bytes = item->img.bytes;
+        // finished without rendering
+        if( !item->nspec ){
+            img_dispose( &item->img );
+            queue_push( r->queues[IMG_RUN_ENCODE], item );
+        }
+        else {
+            queue_push( r->queues[IMG_RUN_DECODE], item );
+        }
+    }
+    run_exit( r, IMG_RUN_DECODE );
+    
+    return NULL;
+}
+
+
+// render all specs of the item, and release the source image
+static void run_render( img_run_t *r, img_run_item_t *item )
+{
+    Imlib_Image src = img_wrap( &item->img );
+    img_run_spec_t *s = NULL;
+    int i = 0;
+    
+    for(; i < item->nspec; i++ )
+    {
+        s = &item->specs[i];
+        // format of the source by default
+        if( !*s->out.format ){
+            s->out.format = item->img.format;
+        }
+        s->start = stats_now();
+        if( run_cancelled( r ) ){
+            s->errnum = ECANCELED;
+        }
+        else {
+            IMLIB_LOCK();
+            if( !( s->work = img_render( &item->img, src, &s->out.spec ) ) ){
+                s->errnum = errno;
+            }
+            IMLIB_UNLOCK();
+        }
+        queue_push( r->queues[IMG_RUN_RENDER], s );
+    }
+    img_unwrap( &item->img, src );
+    img_dispose( &item->img );
+}
+
+
+static void *run_resizer( void *arg )
+{
+    img_run_t *r = (img_run_t*)arg;
+    img_run_item_t *item = NULL;
+    
+    while( ( item = queue_pop( r->queues[IMG_RUN_DECODE] ) ) ){
+        run_render( r, item );
+    }
+    run_exit( r, IMG_RUN_RENDER );
+    
+    return NULL;
+}
+
+
+// encode the rendered image of the spec and write it to the destination
+static void run_output( img_run_t *r, img_run_spec_t *s )
+{
+    membuf_t buf;
+    
+    membuf_init( &buf );
+    IMLIB_LOCK();
+    imlib_context_set_image( s->work );
+    s->work = NULL;
+    if( run_cancelled( r ) ){
+        canvas_free();
+        IMLIB_UNLOCK();
+        s->errnum = ECANCELED;
+    }
+    else if( output_spec( &s->out.spec, &s->out.dest, &buf, s->out.quality, 
+                          s->out.format, NULL ) != 0 ){
+        s->errnum = errno;
+    }
+    stats_op( STATS_SAVE + s->out.spec.mode, s->out.format, s->start, 
+              s->item->bytes, buf.len, s->errnum );
+    membuf_dispose( &buf );
+}
+
+
+static void *run_encoder( void *arg )
+{
+    img_run_t *r = (img_run_t*)arg;
+    img_run_spec_t *s = NULL;
+    
+    while( ( s = queue_pop( r->queues[IMG_RUN_RENDER] ) ) )
+    {
+        if( s->work ){
+            run_output( r, s );
+        }
+        run_spec_done( r, s );
+    }
+    run_exit( r, IMG_RUN_ENCODE );
+    
+    return NULL;
+}
+
+
+int img_run_start( img_run_t *r, const int nthread[IMG_RUN_NSTAGE], 
+                   int depth )
+{
+    static void *(*const fn[IMG_RUN_NSTAGE])( void* ) = { 
+        run_decoder, run_resizer, run_encoder 
+    };
+    int i = 0;
+    int j = 0;
+    int rc = 0;
+    
+    r->next = 0;
+    r->cancel = 0;
+    r->nthread = 0;
+    r->errnum = 0;
+    for(; i < IMG_RUN_NSTAGE; i++ )
+    {
+        r->live[i] = nthread[i];
+        if( !( r->queues[i] = queue_new( (size_t)depth ) ) ){
+            while( i-- ){
+                queue_free( r->queues[i] );
+            }
+            return -1;
+        }
+    }
+    
+    // start the stages from the encoders, so that the started threads 
+    // always have the consumers of their output
+    for( i = IMG_RUN_NSTAGE - 1; i >= 0; i-- )
+    {
+        for( j = 0; j < nthread[i]; j++ )
+        {
+            if( !r->errnum && 
+                ( rc = pthread_create( &r->threads[r->nthread], NULL, fn[i], 
+                                       r ) ) == 0 ){
+                r->nthread++;
+                continue;
+            }
+            // stop the pipeline
+            else if( !r->errnum ){
+                r->errnum = rc;
+                img_run_cancel( r );
+            }
+            run_exit( r, i );
+        }
+    }
+    
+    return 0;
+}
+
+
+img_run_item_t *img_run_next( img_run_t *r )
+{
+    return (img_run_item_t*)queue_pop( r->queues[IMG_RUN_ENCODE] );
+}
+
+
+void img_run_cancel( img_run_t *r )
+{
+    __atomic_store_n( &r->cancel, 1, __ATOMIC_RELAXED );
+}
+
+
+void img_run_finish( img_run_t *r )
+{
+    int i = 0;
+    
+    for(; i < r->nthread; i++ ){
+        pthread_join( r->threads[i], NULL );
+    }
+    for( i = 0; i < IMG_RUN_NSTAGE; i++ ){
+        queue_free( r->queues[i] );
+    }
+}
+
+
@@ -0,0 +1,383 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  img.h
+ *  lua-thumbnailer
+ *
+ *  core image operations without the lua binding.
+ *
+ */
+
+#ifndef ___THUMBNAILER_IMG_H___
+#define ___THUMBNAILER_IMG_H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <Imlib2.h>
+#include "codec.h"
+#include "membuf.h"
+#include "cache.h"
+#include "queue.h"
+
+// default file format
+#define DEFAULT_FORMAT  "png"
+#define MAX_FORMAT_LEN  15
+// max length of the key of the image cache
+#define CACHE_KEY_LEN   ( PATH_MAX + 128 )
+// max number of threads to render an image
+#define BAND_MAX_THREADS    64
+
+
+
+enum img_align_e {
+    IMG_ALIGN_NONE = 0,
+    IMG_ALIGN_LEFT,
+    IMG_ALIGN_CENTER,
+    IMG_ALIGN_RIGHT,
+    IMG_ALIGN_TOP,
+    IMG_ALIGN_MIDDLE,
+    IMG_ALIGN_BOTTOM
+};
+
+typedef struct {
+    int w;
+    int h;
+} img_size_t;
+
+
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} img_bounds_t;
+
+
+enum img_mode_e {
+    IMG_MODE_STRETCH = 0,
+    IMG_MODE_CROP,
+    IMG_MODE_TRIM,
+    IMG_MODE_ASPECT
+};
+
+
+// export parameters of thumbnail
+typedef struct {
+    uint8_t mode;
+    uint8_t halign;
+    uint8_t valign;
+    img_size_t resize;
+    // resample filter
+    uint8_t filter;
+    // background color of aspect mode
+    float hue;
+    float saturation;
+    float lightness;
+    int alpha;
+    // options of the native encoders
+    codec_opts_t enc;
+} img_spec_t;
+
+
+// destination of exported image
+typedef struct {
+    // save to path
+    const char *path;
+    // or write to file descriptor
+    int fd;
+    // or encode into memory
+    membuf_t *buf;
+} img_dest_t;
+
+
+// immutable pixels that shared by the images of the cache
+typedef struct {
+    int ref;
+    Imlib_Image imimg;
+    void *blob;
+    size_t bytes;
+    img_size_t size;
+    img_size_t orig;
+    char format[MAX_FORMAT_LEN];
+} img_pixels_t;
+
+
+typedef struct img_s {
+    // pixels that shared with the cache, or NULL if the image owns the blob
+    img_pixels_t *shared;
+    // decoded image that owns the blob, or NULL if the blob is allocated 
+    // by bufpool_alloc
+    Imlib_Image imimg;
+    void *blob;
+    // blob refers to the data that kept by the environment of userdata
+    uint8_t borrowed;
+    size_t bytes;
+    img_size_t size;
+    // size of the source image before scaled decoding
+    img_size_t orig;
+    img_size_t resize;
+    uint8_t quality;
+    uint8_t filter;
+    char format[MAX_FORMAT_LEN];
+    // number of pool jobs that refer to this image
+    int njob;
+    // number of pool jobs that have not been run yet (guarded by JOB_MUTEX)
+    int nrun;
+    // dispose after all pool jobs are collected
+    uint8_t release;
+    // digest of the source that keys the output cache
+    uint8_t digested;
+    uint64_t digest[2];
+} img_t;
+
+
+typedef struct {
+    img_dest_t dest;
+    const char *format;
+    uint8_t quality;
+    img_spec_t spec;
+    // error number of the export
+    int errnum;
+} img_batch_t;
+
+
+// imlib2 keeps the current image and color in the context of the process 
+// wide stack. every imlib2 call must be made while holding this lock, that 
+// pushes the private context of the module so that the lua states in the 
+// other threads and the host never see each other's image and color.
+extern pthread_mutex_t IMLIB_MUTEX;
+
+void img_imlib_lock( void );
+void img_imlib_unlock( void );
+
+#define IMLIB_LOCK()    img_imlib_lock()
+#define IMLIB_UNLOCK()  img_imlib_unlock()
+
+
+#define SETVAL_IN_RANGE(x,t,val,min,max) do { \
+    if( val < min ){ \
+        (x) = (t)min; \
+    } \
+    else if( val > max ){ \
+        (x) = (t)max; \
+    } \
+    else { \
+        (x) = (t)val; \
+    } \
+}while(0)
+
+
+
+static inline int img_format_copy( img_t *img, const char *format, size_t len )
+{
+    if( len < MAX_FORMAT_LEN ){
+        memcpy( img->format, format, len );
+        img->format[len] = 0;
+        return 0;
+    }
+    
+    return -1;
+}
+
+
+
+static inline void img_spec_init( img_spec_t *spec, img_t *img, uint8_t mode )
+{
+    *spec = (img_spec_t){
+        .mode = mode,
+        .halign = IMG_ALIGN_CENTER,
+        .valign = IMG_ALIGN_MIDDLE,
+        .resize = img->resize,
+        .filter = img->filter,
+        .hue = 0,
+        .saturation = 0,
+        .lightness = 0,
+        .alpha = 255
+    };
+}
+
+
+// MARK: admission control
+typedef struct {
+    // max number of pixels of the image. 0 is unlimited.
+    size_t pixels;
+    // max total bytes of the live blobs. 0 is unlimited.
+    size_t bytes;
+    // total bytes of the live blobs
+    size_t live;
+} img_limits_t;
+
+void img_limits_get( img_limits_t *lim );
+void img_limits_set( size_t pixels, size_t bytes );
+
+// reserve the blob bytes of the image before allocating it.
+// returns 0 on success, or -1 on failure with errno.
+int blob_reserve( int w, int h );
+void blob_release( size_t bytes );
+
+
+// MARK: image
+void img_init( img_t *img, void *blob, int w, int h );
+void img_dispose( img_t *img );
+
+// the following functions return 0 on success, or -1 on failure with errno
+int img_load( img_t *img, const char *path, const codec_hint_t *hint );
+int img_load_buffer( img_t *img, const void *data, size_t len, 
+                     const char *format, const codec_hint_t *hint );
+// convert the raw pixels of the raw pixel format fmt
+int img_read( img_t *img, int w, int h, const void *data, size_t stride, 
+              int fmt );
+// refer to the native pixels that must be alive until the image is disposed
+int img_read_borrowed( img_t *img, int w, int h, void *pixels );
+
+// set the digest of the source by the key string or the data
+void img_digest( img_t *img, const void *data, size_t len );
+// set the digest of the source by the pixels and the size
+void img_digest_pixels( img_t *img );
+
+
+// MARK: export
+// returns the image that can be used as the source of rendering.
+// it must be released by img_unwrap.
+Imlib_Image img_wrap( img_t *img );
+void img_unwrap( img_t *img, Imlib_Image src );
+
+// render the image by spec, and save it to the destination by quality and 
+// format. returns 0 on success, -1 on failure with errno.
+int save_spec( img_t *img, Imlib_Image src, img_spec_t *spec, 
+               img_dest_t *dest, uint8_t quality, const char *format );
+// save_spec with the quality and the format of the image
+int img_export( img_t *img, img_spec_t *spec, img_dest_t *dest );
+// export all items from the shared source in parallel by img_threads(), 
+// and set the error number of each item.
+void img_export_batch( img_t *img, img_batch_t *items, int nitem );
+
+
+// MARK: atlas
+typedef struct {
+    img_t *img;
+    // bounds of the rendered image in the atlas
+    img_bounds_t bounds;
+} img_atlas_item_t;
+
+// render the images by the spec of b into the cells of the size of resize 
+// that arranged in columns, and export the atlas to the destination of b.
+int img_atlas( img_atlas_item_t *items, int nitem, int columns, 
+               img_batch_t *b );
+
+// set the number of threads to render an image if n > 0, and returns it
+int img_threads( int n );
+
+
+// MARK: image cache
+int img_cache_enabled( void );
+// key of the file by path, size and mtime
+int img_cache_key_path( char *key, const char *path, struct stat *st, 
+                        const codec_hint_t *hint );
+// key of the buffer by content
+int img_cache_key_buffer( char *key, const void *data, size_t len, 
+                          const char *format, const codec_hint_t *hint );
+// returns 0 if the image is created by the cached pixels
+int img_cache_get( img_t *img, const char *key );
+void img_cache_put( img_t *img, const char *key );
+int img_cache_resize( size_t bytes );
+int img_cache_stats( cache_stats_t *stats, int reset );
+
+
+// MARK: pipeline
+// the sources of the manifest are decoded, rendered and encoded by the 
+// threads of each stage, and passed between the stages through the bounded 
+// queues. the stage waits while the next queue is full, so the number of 
+// the decoded images and the rendered images in flight is bounded.
+enum {
+    IMG_RUN_DECODE = 0,
+    IMG_RUN_RENDER,
+    IMG_RUN_ENCODE,
+    IMG_RUN_NSTAGE
+};
+
+typedef struct img_run_item_s img_run_item_t;
+
+typedef struct {
+    img_batch_t out;
+    img_run_item_t *item;
+    // rendered image that passed from the resizer to the encoder
+    Imlib_Image work;
+    uint64_t start;
+    int errnum;
+} img_run_spec_t;
+
+
+struct img_run_item_s {
+    // source path, or the encoded data of len bytes
+    const char *path;
+    const char *data;
+    size_t len;
+    const char *format;
+    codec_hint_t hint;
+    img_t img;
+    size_t bytes;
+    img_run_spec_t *specs;
+    int nspec;
+    // number of specs that have not been finished
+    int pending;
+    int errnum;
+};
+
+
+typedef struct {
+    img_run_item_t *items;
+    int nitem;
+    // index of the next item to be decoded
+    int next;
+    int cancel;
+    // number of live threads of each stage
+    int live[IMG_RUN_NSTAGE];
+    // output queue of each stage. the output of the encoders is the queue 
+    // of the finished items.
+    queue_t *queues[IMG_RUN_NSTAGE];
+    // threads of all stages
+    pthread_t *threads;
+    int nthread;
+    // error number of starting the threads
+    int errnum;
+} img_run_t;
+
+// start the threads of the stages. threads of r must have room for the 
+// sum of nthread. if some threads could not be started, the pipeline is 
+// cancelled and errnum of r is set.
+// returns 0 on success, or -1 on failure with errno.
+int img_run_start( img_run_t *r, const int nthread[IMG_RUN_NSTAGE], 
+                   int depth );
+// returns the finished item, or NULL if all items are finished. the items 
+// must be taken until it returns NULL.
+img_run_item_t *img_run_next( img_run_t *r );
+// skip the items that have not been finished
+void img_run_cancel( img_run_t *r );
+// join the threads and release the queues
+void img_run_finish( img_run_t *r );
+
+#endif
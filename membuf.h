@@ -0,0 +1,142 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  membuf.h
+ *  lua-thumbnailer
+ *
+ *  growable memory buffer for encoded images.
+ *
+ */
+
+#ifndef ___THUMBNAILER_MEMBUF_H___
+#define ___THUMBNAILER_MEMBUF_H___
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MEMBUF_MIN_CAP  4096
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} membuf_t;
+
+
+static inline void membuf_init( membuf_t *buf )
+{
+    *buf = (membuf_t){ NULL, 0, 0 };
+}
+
+
+static inline void membuf_dispose( membuf_t *buf )
+{
+    if( buf->data ){
+        free( buf->data );
+    }
+    membuf_init( buf );
+}
+
+
+static inline int membuf_reserve( membuf_t *buf, size_t bytes )
+{
+    size_t need = buf->len + bytes;
+    
+    if( need > buf->cap )
+    {
+        size_t cap = buf->cap ? buf->cap : MEMBUF_MIN_CAP;
+        uint8_t *data = NULL;
+        
+        while( cap < need ){
+            cap <<= 1;
+        }
+        if( !( data = realloc( buf->data, cap ) ) ){
+            errno = ENOMEM;
+            return -1;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    
+    return 0;
+}
+
+
+static inline int membuf_append( membuf_t *buf, const void *data, size_t bytes )
+{
+    if( membuf_reserve( buf, bytes ) == 0 ){
+        memcpy( buf->data + buf->len, data, bytes );
+        buf->len += bytes;
+        return 0;
+    }
+    
+    return -1;
+}
+
+
+// write all data to fd
+static inline int membuf_write( membuf_t *buf, int fd )
+{
+    size_t pos = 0;
+    ssize_t len = 0;
+    
+    while( pos < buf->len )
+    {
+        if( ( len = write( fd, buf->data + pos, buf->len - pos ) ) > 0 ){
+            pos += (size_t)len;
+        }
+        else if( len == -1 && errno != EINTR ){
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+
+// read all data from fd
+static inline int membuf_read( membuf_t *buf, int fd )
+{
+    ssize_t len = 0;
+    
+    while( membuf_reserve( buf, MEMBUF_MIN_CAP ) == 0 )
+    {
+        if( ( len = read( fd, buf->data + buf->len, 
+                          buf->cap - buf->len ) ) > 0 ){
+            buf->len += (size_t)len;
+        }
+        else if( len == 0 ){
+            return 0;
+        }
+        else if( errno != EINTR ){
+            return -1;
+        }
+    }
+    
+    return -1;
+}
+
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  outcache.c
+ *  lua-thumbnailer
+ *
+ *  content-addressed on-disk cache of the encoded images.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "membuf.h"
+#include "outcache.h"
+
+typedef struct {
+    int ref;
+    char path[];
+} entry_t;
+
+
+typedef struct {
+    char key[OUTCACHE_KEY_LEN];
+    off_t size;
+    time_t mtime;
+} scan_t;
+
+
+// index of the cached files. the configuration is replaced under the 
+// write lock.
+static pthread_rwlock_t OC_LOCK = PTHREAD_RWLOCK_INITIALIZER;
+static cache_t *OC_INDEX = NULL;
+static char *OC_DIR = NULL;
+static size_t OC_CAPACITY = 0;
+static int OC_LINK = 0;
+static unsigned int OC_SEQ = 0;
+
+
+static void entry_retain( void *val )
+{
+    __atomic_add_fetch( &((entry_t*)val)->ref, 1, __ATOMIC_RELAXED );
+}
+
+
+static void entry_release( void *val )
+{
+    if( __atomic_sub_fetch( &((entry_t*)val)->ref, 1, __ATOMIC_ACQ_REL ) == 0 ){
+        free( val );
+    }
+}
+
+
+static void entry_evict( void *val )
+{
+    unlink( ((entry_t*)val)->path );
+}
+
+
+static const cache_ops_t OC_OPS = {
+    entry_retain,
+    entry_release,
+    entry_evict
+};
+
+
+static int is_key( const char *name )
+{
+    size_t i = 0;
+    
+    for(; i < OUTCACHE_KEY_LEN - 1; i++ ){
+        if( !( ( name[i] >= '0' && name[i] <= '9' ) || 
+               ( name[i] >= 'a' && name[i] <= 'f' ) ) ){
+            return 0;
+        }
+    }
+    
+    return name[i] == 0;
+}
+
+
+static entry_t *entry_new( const char *dir, const char *key )
+{
+    size_t len = strlen( dir ) + OUTCACHE_KEY_LEN + 1;
+    entry_t *e = malloc( sizeof( entry_t ) + len );
+    
+    if( !e ){
+        errno = ENOMEM;
+        return NULL;
+    }
+    e->ref = 1;
+    snprintf( e->path, len, "%s/%s", dir, key );
+    
+    return e;
+}
+
+
+static int index_put( cache_t *index, const char *dir, const char *key, 
+                      size_t bytes )
+{
+    entry_t *e = entry_new( dir, key );
+    
+    int rc = -1;
+    
+    if( e ){
+        // the index retains the entry
+        rc = cache_put( index, key, e, bytes );
+        entry_release( e );
+    }
+    
+    return rc;
+}
+
+
+static int scan_cmp( const void *a, const void *b )
+{
+    time_t x = ((const scan_t*)a)->mtime;
+    time_t y = ((const scan_t*)b)->mtime;
+    
+    return x < y ? -1 : x > y;
+}
+
+
+// index the cached files from the oldest to the newest
+static int index_scan( cache_t *index, const char *dir )
+{
+    DIR *dp = opendir( dir );
+    struct dirent *entry = NULL;
+    scan_t *list = NULL;
+    size_t nlist = 0;
+    size_t cap = 0;
+    size_t i = 0;
+    
+    if( !dp ){
+        return -1;
+    }
+    while( ( entry = readdir( dp ) ) )
+    {
+        struct stat st;
+        
+        if( !is_key( entry->d_name ) || 
+            fstatat( dirfd( dp ), entry->d_name, &st, 0 ) != 0 || 
+            !S_ISREG( st.st_mode ) ){
+            continue;
+        }
+        else if( nlist == cap )
+        {
+            scan_t *next = realloc( list, sizeof( scan_t ) * 
+                                    ( cap ? cap * 2 : 64 ) );
+            
+            if( !next ){
+                free( list );
+                closedir( dp );
+                errno = ENOMEM;
+                return -1;
+            }
+            list = next;
+            cap = cap ? cap * 2 : 64;
+        }
+        memcpy( list[nlist].key, entry->d_name, OUTCACHE_KEY_LEN );
+        list[nlist].size = st.st_size;
+        list[nlist].mtime = st.st_mtime;
+        nlist++;
+    }
+    closedir( dp );
+    
+    qsort( list, nlist, sizeof( scan_t ), scan_cmp );
+    for(; i < nlist; i++ )
+    {
+        // remove the file that larger than the capacity
+        if( index_put( index, dir, list[i].key, (size_t)list[i].size ) != 0 && 
+            errno == E2BIG ){
+            char path[PATH_MAX];
+            
+            snprintf( path, sizeof( path ), "%s/%s", dir, list[i].key );
+            unlink( path );
+        }
+    }
+    free( list );
+    
+    return 0;
+}
+
+
+int outcache_config( const char *dir, size_t capacity, int link )
+{
+    cache_t *index = NULL;
+    char *copy = NULL;
+    int rc = 0;
+    
+    pthread_rwlock_wrlock( &OC_LOCK );
+    // reindex the new directory
+    if( dir && ( !OC_DIR || strcmp( OC_DIR, dir ) != 0 ) )
+    {
+        if( strlen( dir ) + OUTCACHE_KEY_LEN + 32 > PATH_MAX ){
+            errno = ENAMETOOLONG;
+            rc = -1;
+        }
+        else if( mkdir( dir, 0777 ) != 0 && errno != EEXIST ){
+            rc = -1;
+        }
+        else if( !( copy = strdup( dir ) ) || 
+                 !( index = cache_new( &OC_OPS ) ) ){
+            errno = ENOMEM;
+            rc = -1;
+        }
+        else {
+            cache_resize( index, capacity );
+            if( ( rc = index_scan( index, dir ) ) == 0 )
+            {
+                if( OC_INDEX ){
+                    cache_free( OC_INDEX );
+                    free( OC_DIR );
+                }
+                OC_INDEX = index;
+                OC_DIR = copy;
+                index = NULL;
+                copy = NULL;
+            }
+        }
+        if( index ){
+            cache_free( index );
+        }
+        free( copy );
+    }
+    
+    if( rc == 0 && !OC_INDEX && capacity > 0 ){
+        errno = EINVAL;
+        rc = -1;
+    }
+    if( rc == 0 )
+    {
+        OC_CAPACITY = capacity;
+        OC_LINK = link;
+        if( OC_INDEX ){
+            cache_resize( OC_INDEX, capacity );
+        }
+    }
+    pthread_rwlock_unlock( &OC_LOCK );
+    
+    return rc;
+}
+
+
+int outcache_enabled( void )
+{
+    int enabled = 0;
+    
+    pthread_rwlock_rdlock( &OC_LOCK );
+    enabled = OC_INDEX && OC_CAPACITY > 0;
+    pthread_rwlock_unlock( &OC_LOCK );
+    
+    return enabled;
+}
+
+
+int outcache_link( void )
+{
+    int link = 0;
+    
+    pthread_rwlock_rdlock( &OC_LOCK );
+    link = OC_LINK;
+    pthread_rwlock_unlock( &OC_LOCK );
+    
+    return link;
+}
+
+
+int outcache_get( const char *key, char *path, size_t len )
+{
+    entry_t *e = NULL;
+    int rc = -1;
+    
+    pthread_rwlock_rdlock( &OC_LOCK );
+    if( OC_INDEX && OC_CAPACITY > 0 && 
+        ( e = (entry_t*)cache_get( OC_INDEX, key ) ) )
+    {
+        if( strlen( e->path ) < len ){
+            strcpy( path, e->path );
+            // keep the order of use for the next scan. the cached files 
+            // share the inode with the destinations in link mode, so they 
+            // keep the order of creation not to touch the outputs.
+            if( !OC_LINK ){
+                utimensat( AT_FDCWD, path, NULL, 0 );
+            }
+            rc = 0;
+        }
+        entry_release( e );
+    }
+    pthread_rwlock_unlock( &OC_LOCK );
+    
+    return rc;
+}
+
+
+int outcache_put( const char *key, const void *data, size_t len )
+{
+    char tmp[PATH_MAX + 32];
+    char path[PATH_MAX];
+    membuf_t buf = { (uint8_t*)data, len, len };
+    int fd = -1;
+    int rc = -1;
+    
+    pthread_rwlock_rdlock( &OC_LOCK );
+    if( !OC_INDEX || OC_CAPACITY == 0 ){
+        pthread_rwlock_unlock( &OC_LOCK );
+        return 0;
+    }
+    else if( len > OC_CAPACITY ){
+        pthread_rwlock_unlock( &OC_LOCK );
+        errno = E2BIG;
+        return -1;
+    }
+    
+    // write to the temporary file and rename it to the key
+    snprintf( path, sizeof( path ), "%s/%s", OC_DIR, key );
+    snprintf( tmp, sizeof( tmp ), "%s.%d.%u.tmp", path, (int)getpid(), 
+              __atomic_add_fetch( &OC_SEQ, 1, __ATOMIC_RELAXED ) );
+    if( ( fd = open( tmp, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0666 ) ) != -1 )
+    {
+        rc = membuf_write( &buf, fd );
+        if( close( fd ) != 0 ){
+            rc = -1;
+        }
+        if( rc == 0 && ( rc = rename( tmp, path ) ) == 0 ){
+            if( ( rc = index_put( OC_INDEX, OC_DIR, key, len ) ) != 0 ){
+                unlink( path );
+            }
+        }
+        else {
+            unlink( tmp );
+        }
+    }
+    pthread_rwlock_unlock( &OC_LOCK );
+    
+    return rc;
+}
+
+
+void outcache_stats( outcache_stats_t *stats, int reset )
+{
+    pthread_rwlock_rdlock( &OC_LOCK );
+    stats->dir = OC_DIR ? strdup( OC_DIR ) : NULL;
+    stats->link = OC_LINK;
+    if( OC_INDEX ){
+        cache_stats( OC_INDEX, &stats->index, reset );
+    }
+    else {
+        stats->index = (cache_stats_t){ 0, 0, 0, 0, 0, 0 };
+    }
+    stats->index.capacity = OC_CAPACITY;
+    pthread_rwlock_unlock( &OC_LOCK );
+}
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  outcache.h
+ *  lua-thumbnailer
+ *
+ *  content-addressed on-disk cache of the encoded images.
+ *
+ */
+
+#ifndef ___THUMBNAILER_OUTCACHE_H___
+#define ___THUMBNAILER_OUTCACHE_H___
+
+#include <stddef.h>
+#include "cache.h"
+
+// length of the key string; 32 hex digits and NUL
+#define OUTCACHE_KEY_LEN    33
+
+typedef struct {
+    // copy of the cache directory, or NULL
+    char *dir;
+    int link;
+    cache_stats_t index;
+} outcache_stats_t;
+
+
+// set the cache directory and the capacity in bytes. the directory is 
+// created if not exists, and the files in the directory are indexed in 
+// order of the modification time. if dir is NULL, the current directory is 
+// kept. capacity 0 disables the cache. if link is non-zero, the cached files 
+// are hard-linked to the destination paths.
+// returns 0 on success, or -1 on failure with errno.
+int outcache_config( const char *dir, size_t capacity, int link );
+
+int outcache_enabled( void );
+
+// returns 1 if the destination paths should be hard-linked
+int outcache_link( void );
+
+// copy the path of the cached file of the key into path. the file may be 
+// removed at any time by the other threads.
+// returns 0 on success, or -1 if not found.
+int outcache_get( const char *key, char *path, size_t len );
+
+// store the data as the cached file of the key.
+// returns 0 on success, or -1 on failure with errno.
+int outcache_put( const char *key, const void *data, size_t len );
+
+// stats.dir must be freed by caller
+void outcache_stats( outcache_stats_t *stats, int reset );
+
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  pool.c
+ *  lua-thumbnailer
+ *
+ *  worker thread pool with a pollable completion descriptor.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "pool.h"
+
+typedef struct {
+    pool_job_t *head;
+    pool_job_t *tail;
+} joblist_t;
+
+
+struct pool_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int shutdown;
+    joblist_t pending;
+    joblist_t done;
+    // completion notifier
+    int fd;
+    int wfd;
+    int nthreads;
+    pthread_t threads[];
+};
+
+
+static inline void joblist_push( joblist_t *list, pool_job_t *job )
+{
+    job->next = NULL;
+    if( list->tail ){
+        list->tail->next = job;
+    }
+    else {
+        list->head = job;
+    }
+    list->tail = job;
+}
+
+
+static inline pool_job_t *joblist_shift( joblist_t *list )
+{
+    pool_job_t *job = list->head;
+    
+    if( job && !( list->head = job->next ) ){
+        list->tail = NULL;
+    }
+    
+    return job;
+}
+
+
+static inline pool_job_t *joblist_concat( joblist_t *list, pool_job_t *job )
+{
+    if( list->tail ){
+        list->tail->next = job;
+        return list->head;
+    }
+    
+    return job;
+}
+
+
+static int notifier_open( pool_t *pool )
+{
+#ifdef __linux__
+    if( ( pool->fd = eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC ) ) != -1 ){
+        pool->wfd = pool->fd;
+        return 0;
+    }
+#else
+    int fds[2];
+    
+    if( pipe( fds ) == 0 )
+    {
+        if( fcntl( fds[0], F_SETFL, O_NONBLOCK ) == 0 && 
+            fcntl( fds[1], F_SETFL, O_NONBLOCK ) == 0 &&
+            fcntl( fds[0], F_SETFD, FD_CLOEXEC ) == 0 && 
+            fcntl( fds[1], F_SETFD, FD_CLOEXEC ) == 0 ){
+            pool->fd = fds[0];
+            pool->wfd = fds[1];
+            return 0;
+        }
+        close( fds[0] );
+        close( fds[1] );
+    }
+#endif
+    
+    return -1;
+}
+
+
+static void notifier_close( pool_t *pool )
+{
+    if( pool->wfd != pool->fd ){
+        close( pool->wfd );
+    }
+    close( pool->fd );
+}
+
+
+static void notifier_signal( pool_t *pool )
+{
+    uint64_t val = 1;
+    
+    // counter of eventfd or buffer of pipe is already readable if failed
+    while( write( pool->wfd, &val, pool->wfd == pool->fd ? 8 : 1 ) == -1 && 
+           errno == EINTR ){}
+}
+
+
+static void notifier_drain( pool_t *pool )
+{
+    uint64_t val = 0;
+    ssize_t len = 0;
+    
+    while( ( len = read( pool->fd, &val, sizeof( val ) ) ) > 0 || 
+           ( len == -1 && errno == EINTR ) ){}
+}
+
+
+static void *worker( void *arg )
+{
+    pool_t *pool = (pool_t*)arg;
+    pool_job_t *job = NULL;
+    
+    pthread_mutex_lock( &pool->mutex );
+    while( !pool->shutdown )
+    {
+        if( !( job = joblist_shift( &pool->pending ) ) ){
+            pthread_cond_wait( &pool->cond, &pool->mutex );
+            continue;
+        }
+        
+        pthread_mutex_unlock( &pool->mutex );
+        job->run( job );
+        pthread_mutex_lock( &pool->mutex );
+        joblist_push( &pool->done, job );
+        notifier_signal( pool );
+    }
+    pthread_mutex_unlock( &pool->mutex );
+    
+    return NULL;
+}
+
+
+static void pool_join( pool_t *pool )
+{
+    int i = 0;
+    
+    pthread_mutex_lock( &pool->mutex );
+    pool->shutdown = 1;
+    pthread_cond_broadcast( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+    for(; i < pool->nthreads; i++ ){
+        pthread_join( pool->threads[i], NULL );
+    }
+}
+
+
+pool_t *pool_new( int nthreads )
+{
+    pool_t *pool = NULL;
+    int rc = 0;
+    
+    if( nthreads < 1 ){
+        errno = EINVAL;
+        return NULL;
+    }
+    else if( !( pool = calloc( 1, sizeof( pool_t ) + 
+                                  sizeof( pthread_t ) * (size_t)nthreads ) ) ){
+        return NULL;
+    }
+    else if( notifier_open( pool ) != 0 ){
+        free( pool );
+        return NULL;
+    }
+    
+    pthread_mutex_init( &pool->mutex, NULL );
+    pthread_cond_init( &pool->cond, NULL );
+    for(; pool->nthreads < nthreads; pool->nthreads++ )
+    {
+        if( ( rc = pthread_create( &pool->threads[pool->nthreads], NULL, 
+                                   worker, pool ) ) ){
+            pool_join( pool );
+            pthread_cond_destroy( &pool->cond );
+            pthread_mutex_destroy( &pool->mutex );
+            notifier_close( pool );
+            free( pool );
+            errno = rc;
+            return NULL;
+        }
+    }
+    
+    return pool;
+}
+
+
+pool_job_t *pool_free( pool_t *pool )
+{
+    pool_job_t *jobs = NULL;
+    
+    pool_join( pool );
+    jobs = joblist_concat( &pool->done, pool->pending.head );
+    pthread_cond_destroy( &pool->cond );
+    pthread_mutex_destroy( &pool->mutex );
+    notifier_close( pool );
+    free( pool );
+    
+    return jobs;
+}
+
+
+void pool_submit( pool_t *pool, pool_job_t *job )
+{
+    pthread_mutex_lock( &pool->mutex );
+    joblist_push( &pool->pending, job );
+    pthread_cond_signal( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+}
+
+
+int pool_fd( pool_t *pool )
+{
+    return pool->fd;
+}
+
+
+pool_job_t *pool_collect( pool_t *pool )
+{
+    pool_job_t *jobs = NULL;
+    
+    // drain the notifier before taking the list to not lose the signal
+    notifier_drain( pool );
+    pthread_mutex_lock( &pool->mutex );
+    jobs = pool->done.head;
+    pool->done = (joblist_t){ NULL, NULL };
+    pthread_mutex_unlock( &pool->mutex );
+    
+    return jobs;
+}
+
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  pool.h
+ *  lua-thumbnailer
+ *
+ *  worker thread pool with a pollable completion descriptor.
+ *
+ */
+
+#ifndef ___THUMBNAILER_POOL_H___
+#define ___THUMBNAILER_POOL_H___
+
+typedef struct pool_job_s pool_job_t;
+
+struct pool_job_s {
+    pool_job_t *next;
+    // called on the worker thread
+    void (*run)( pool_job_t *job );
+};
+
+typedef struct pool_s pool_t;
+
+
+// returns NULL on failure with errno
+pool_t *pool_new( int nthreads );
+
+// stop and join the worker threads after the running jobs are finished, 
+// and release the pool. returns the list of jobs that has not been 
+// collected, including the jobs that were not run.
+pool_job_t *pool_free( pool_t *pool );
+
+void pool_submit( pool_t *pool, pool_job_t *job );
+
+// returns the descriptor that becomes readable when the jobs are finished
+int pool_fd( pool_t *pool );
+
+// returns the list of finished jobs in order of completion, or NULL
+pool_job_t *pool_collect( pool_t *pool );
+
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  probe.c
+ *  lua-thumbnailer
+ *
+ *  header-only image probe.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "probe.h"
+
+// max number of blocks to be scanned for the transparency of gif
+#define GIF_MAX_BLOCKS  256
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    int fd;
+} probe_src_t;
+
+
+static int src_read( probe_src_t *src, size_t off, void *buf, size_t len )
+{
+    uint8_t *p = (uint8_t*)buf;
+    ssize_t rv = 0;
+    
+    if( src->data )
+    {
+        if( off > src->len || len > src->len - off ){
+            return -1;
+        }
+        memcpy( buf, src->data + off, len );
+        return 0;
+    }
+    
+    while( len )
+    {
+        if( ( rv = pread( src->fd, p, len, (off_t)off ) ) > 0 ){
+            p += rv;
+            off += (size_t)rv;
+            len -= (size_t)rv;
+        }
+        else if( rv == 0 || errno != EINTR ){
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+
+#define BE16(p) ((unsigned int)(p)[0] << 8 | (p)[1])
+#define BE32(p) ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | \
+                 (uint32_t)(p)[2] << 8 | (p)[3])
+#define LE16(p) ((unsigned int)(p)[1] << 8 | (p)[0])
+#define LE24(p) ((uint32_t)(p)[2] << 16 | (uint32_t)(p)[1] << 8 | (p)[0])
+#define LE32(p) ((uint32_t)(p)[3] << 24 | (uint32_t)(p)[2] << 16 | \
+                 (uint32_t)(p)[1] << 8 | (p)[0])
+
+
+static inline uint32_t tiff_get( const uint8_t *p, int le, int bytes )
+{
+    if( bytes == 2 ){
+        return le ? LE16( p ) : BE16( p );
+    }
+    
+    return le ? LE32( p ) : BE32( p );
+}
+
+
+int probe_exif( probe_info_t *info, const uint8_t *tiff, size_t len )
+{
+    int le = 0;
+    uint32_t off = 0;
+    uint32_t thumb_off = 0;
+    uint32_t thumb_len = 0;
+    unsigned int n = 0;
+    
+    if( len < 8 ){
+        return -1;
+    }
+    else if( memcmp( tiff, "II*\0", 4 ) == 0 ){
+        le = 1;
+    }
+    else if( memcmp( tiff, "MM\0*", 4 ) != 0 ){
+        return -1;
+    }
+    
+    // IFD0
+    off = tiff_get( tiff + 4, le, 4 );
+    if( off > len - 2 ){
+        return -1;
+    }
+    n = tiff_get( tiff + off, le, 2 );
+    for( off += 2; n && off + 12 <= len; n--, off += 12 )
+    {
+        // orientation
+        if( tiff_get( tiff + off, le, 2 ) == 0x0112 )
+        {
+            uint32_t v = tiff_get( tiff + off + 8, le, 2 );
+            
+            if( v >= 1 && v <= 8 ){
+                info->orientation = (int)v;
+            }
+        }
+    }
+    
+    // IFD1 of the thumbnail follows the entries of IFD0
+    if( n || off + 4 > len || 
+        ( off = tiff_get( tiff + off, le, 4 ) ) == 0 || off > len - 2 ){
+        return 0;
+    }
+    n = tiff_get( tiff + off, le, 2 );
+    for( off += 2; n && off + 12 <= len; n--, off += 12 )
+    {
+        switch( tiff_get( tiff + off, le, 2 ) ){
+            // JPEGInterchangeFormat
+            case 0x0201:
+                thumb_off = tiff_get( tiff + off + 8, le, 4 );
+            break;
+            // JPEGInterchangeFormatLength
+            case 0x0202:
+                thumb_len = tiff_get( tiff + off + 8, le, 4 );
+            break;
+        }
+    }
+    if( thumb_off && thumb_len && thumb_off <= len && 
+        thumb_len <= len - thumb_off ){
+        info->thumb_off = thumb_off;
+        info->thumb_len = thumb_len;
+    }
+    
+    return 0;
+}
+
+
+static int probe_jpeg( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t buf[UINT16_MAX];
+    size_t off = 2;
+    unsigned int marker = 0;
+    unsigned int len = 0;
+    int exif = 0;
+    
+    for(;;)
+    {
+        if( src_read( src, off, buf, 4 ) != 0 || buf[0] != 0xFF ){
+            return -1;
+        }
+        marker = buf[1];
+        // fill bytes
+        if( marker == 0xFF ){
+            off++;
+            continue;
+        }
+        // standalone markers
+        else if( marker == 0x01 || ( marker >= 0xD0 && marker <= 0xD8 ) ){
+            off += 2;
+            continue;
+        }
+        // reached the image data without frame header
+        else if( marker == 0xD9 || marker == 0xDA ){
+            return -1;
+        }
+        
+        if( ( len = BE16( buf + 2 ) ) < 2 ){
+            return -1;
+        }
+        // start of frame
+        else if( marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && 
+                 marker != 0xC8 && marker != 0xCC )
+        {
+            if( src_read( src, off + 4, buf, 5 ) != 0 ){
+                return -1;
+            }
+            info->h = (int)BE16( buf + 1 );
+            info->w = (int)BE16( buf + 3 );
+            return 0;
+        }
+        // first APP1 (EXIF)
+        else if( marker == 0xE1 && !exif && len > 8 && 
+                 src_read( src, off + 4, buf, len - 2 ) == 0 && 
+                 memcmp( buf, "Exif\0\0", 6 ) == 0 ){
+            exif = 1;
+            if( probe_exif( info, buf + 6, len - 8 ) == 0 && 
+                info->thumb_len ){
+                // offset from the head of the data
+                info->thumb_off += off + 10;
+            }
+        }
+        off += 2 + len;
+    }
+}
+
+
+static int probe_png( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t buf[26];
+    size_t off = 8;
+    
+    // IHDR
+    if( src_read( src, off, buf, 21 ) != 0 || 
+        memcmp( buf + 4, "IHDR", 4 ) != 0 ){
+        return -1;
+    }
+    info->w = (int)BE32( buf + 8 );
+    info->h = (int)BE32( buf + 12 );
+    // gray+alpha or rgb+alpha
+    if( buf[17] == 4 || buf[17] == 6 ){
+        info->alpha = 1;
+        return 0;
+    }
+    
+    // find tRNS chunk before image data
+    off += 12 + BE32( buf );
+    while( src_read( src, off, buf, 8 ) == 0 )
+    {
+        if( memcmp( buf + 4, "tRNS", 4 ) == 0 ){
+            info->alpha = 1;
+            break;
+        }
+        else if( memcmp( buf + 4, "IDAT", 4 ) == 0 || 
+                 memcmp( buf + 4, "IEND", 4 ) == 0 ){
+            break;
+        }
+        off += 12 + BE32( buf );
+    }
+    
+    return 0;
+}
+
+
+static int probe_gif( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t buf[8];
+    size_t off = 13;
+    int nblock = 0;
+    
+    if( src_read( src, 6, buf, 7 ) != 0 ){
+        return -1;
+    }
+    info->w = (int)LE16( buf );
+    info->h = (int)LE16( buf + 2 );
+    // global color table
+    if( buf[4] & 0x80 ){
+        off += 3U << ( ( buf[4] & 0x7 ) + 1 );
+    }
+    
+    // find transparent color in graphic control extension of first image
+    for(; nblock < GIF_MAX_BLOCKS && src_read( src, off, buf, 2 ) == 0; 
+        nblock++ )
+    {
+        // image descriptor or trailer
+        if( buf[0] != 0x21 ){
+            break;
+        }
+        // graphic control extension
+        else if( buf[1] == 0xF9 ){
+            if( src_read( src, off + 2, buf, 2 ) == 0 && ( buf[1] & 0x1 ) ){
+                info->alpha = 1;
+            }
+            break;
+        }
+        // skip sub-blocks
+        for( off += 2; src_read( src, off, buf, 1 ) == 0 && buf[0]; 
+             off += 1 + buf[0] ){}
+        off++;
+    }
+    
+    return 0;
+}
+
+
+static int probe_webp( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t buf[18];
+    
+    if( src_read( src, 12, buf, 18 ) != 0 ){
+        return -1;
+    }
+    // extended format
+    else if( memcmp( buf, "VP8X", 4 ) == 0 ){
+        info->alpha = ( buf[8] & 0x10 ) != 0;
+        info->w = (int)LE24( buf + 12 ) + 1;
+        info->h = (int)LE24( buf + 15 ) + 1;
+    }
+    // lossless
+    else if( memcmp( buf, "VP8L", 4 ) == 0 && buf[8] == 0x2F ){
+        uint32_t bits = LE32( buf + 9 );
+        
+        info->w = (int)( bits & 0x3FFF ) + 1;
+        info->h = (int)( ( bits >> 14 ) & 0x3FFF ) + 1;
+        info->alpha = ( bits >> 28 ) & 0x1;
+    }
+    // lossy
+    else if( memcmp( buf, "VP8 ", 4 ) == 0 && buf[11] == 0x9D && 
+             buf[12] == 0x01 && buf[13] == 0x2A ){
+        info->w = (int)( LE16( buf + 14 ) & 0x3FFF );
+        info->h = (int)( LE16( buf + 16 ) & 0x3FFF );
+    }
+    else {
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+static int probe_bmp( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t buf[16];
+    int32_t h = 0;
+    
+    if( src_read( src, 14, buf, 16 ) != 0 || LE32( buf ) < 40 ){
+        return -1;
+    }
+    info->w = (int32_t)LE32( buf + 4 );
+    h = (int32_t)LE32( buf + 8 );
+    // top-down bitmap has negative height
+    info->h = h < 0 ? -h : h;
+    info->alpha = LE16( buf + 14 ) == 32;
+    
+    return 0;
+}
+
+
+static int probe_src( probe_info_t *info, probe_src_t *src )
+{
+    uint8_t sig[12];
+    int rc = -1;
+    
+    *info = (probe_info_t){ NULL, 0, 0, 0, 1, 0, 0 };
+    if( src_read( src, 0, sig, sizeof( sig ) ) != 0 ){
+        errno = EINVAL;
+        return -1;
+    }
+    else if( sig[0] == 0xFF && sig[1] == 0xD8 && sig[2] == 0xFF ){
+        info->format = "jpeg";
+        rc = probe_jpeg( info, src );
+    }
+    else if( memcmp( sig, "\x89PNG\r\n\x1a\n", 8 ) == 0 ){
+        info->format = "png";
+        rc = probe_png( info, src );
+    }
+    else if( memcmp( sig, "GIF87a", 6 ) == 0 || 
+             memcmp( sig, "GIF89a", 6 ) == 0 ){
+        info->format = "gif";
+        rc = probe_gif( info, src );
+    }
+    else if( memcmp( sig, "RIFF", 4 ) == 0 && 
+             memcmp( sig + 8, "WEBP", 4 ) == 0 ){
+        info->format = "webp";
+        rc = probe_webp( info, src );
+    }
+    else if( sig[0] == 'B' && sig[1] == 'M' ){
+        info->format = "bmp";
+        rc = probe_bmp( info, src );
+    }
+    
+    if( rc != 0 || info->w < 1 || info->h < 1 ){
+        errno = EINVAL;
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+int probe_mem( probe_info_t *info, const void *data, size_t len )
+{
+    probe_src_t src = { (const uint8_t*)data, len, -1 };
+    
+    return probe_src( info, &src );
+}
+
+
+int probe_fd( probe_info_t *info, int fd )
+{
+    probe_src_t src = { NULL, 0, fd };
+    
+    return probe_src( info, &src );
+}
+
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  probe.h
+ *  lua-thumbnailer
+ *
+ *  header-only image probe.
+ *
+ */
+
+#ifndef ___THUMBNAILER_PROBE_H___
+#define ___THUMBNAILER_PROBE_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    // format name: jpeg, png, gif, webp or bmp
+    const char *format;
+    int w;
+    int h;
+    // 1 if the image may have transparent pixels
+    int alpha;
+    // EXIF orientation (1-8). 1 if not specified.
+    int orientation;
+    // offset and length of the embedded EXIF thumbnail (jpeg) in the data. 
+    // thumb_len is 0 if not embedded.
+    size_t thumb_off;
+    size_t thumb_len;
+} probe_info_t;
+
+
+// returns 0 on success, or -1 on failure with errno
+int probe_mem( probe_info_t *info, const void *data, size_t len );
+int probe_fd( probe_info_t *info, int fd );
+
+// parse the TIFF structure of EXIF segment.
+// thumb_off is set to the offset from the head of tiff.
+int probe_exif( probe_info_t *info, const uint8_t *tiff, size_t len );
+
+
+#endif
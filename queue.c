@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  queue.c
+ *  lua-thumbnailer
+ *
+ *  bounded blocking queue between the pipeline stages.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "queue.h"
+
+
+struct queue_s {
+    pthread_mutex_t mutex;
+    // signaled when the item is pushed or popped
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    int closed;
+    size_t cap;
+    size_t head;
+    size_t len;
+    void *items[];
+};
+
+
+queue_t *queue_new( size_t cap )
+{
+    queue_t *q = NULL;
+    
+    if( cap < 1 ){
+        errno = EINVAL;
+        return NULL;
+    }
+    else if( !( q = malloc( sizeof( queue_t ) + sizeof( void* ) * cap ) ) ){
+        return NULL;
+    }
+    
+    pthread_mutex_init( &q->mutex, NULL );
+    pthread_cond_init( &q->readable, NULL );
+    pthread_cond_init( &q->writable, NULL );
+    q->closed = 0;
+    q->cap = cap;
+    q->head = 0;
+    q->len = 0;
+    
+    return q;
+}
+
+
+void queue_free( queue_t *q )
+{
+    pthread_cond_destroy( &q->writable );
+    pthread_cond_destroy( &q->readable );
+    pthread_mutex_destroy( &q->mutex );
+    free( q );
+}
+
+
+int queue_push( queue_t *q, void *item )
+{
+    int rc = -1;
+    
+    pthread_mutex_lock( &q->mutex );
+    while( !q->closed && q->len == q->cap ){
+        pthread_cond_wait( &q->writable, &q->mutex );
+    }
+    if( !q->closed ){
+        q->items[( q->head + q->len++ ) % q->cap] = item;
+        pthread_cond_signal( &q->readable );
+        rc = 0;
+    }
+    pthread_mutex_unlock( &q->mutex );
+    
+    return rc;
+}
+
+
+void *queue_pop( queue_t *q )
+{
+    void *item = NULL;
+    
+    pthread_mutex_lock( &q->mutex );
+    while( !q->closed && !q->len ){
+        pthread_cond_wait( &q->readable, &q->mutex );
+    }
+    if( q->len ){
+        item = q->items[q->head];
+        q->head = ( q->head + 1 ) % q->cap;
+        q->len--;
+        pthread_cond_signal( &q->writable );
+    }
+    pthread_mutex_unlock( &q->mutex );
+    
+    return item;
+}
+
+
+void queue_close( queue_t *q )
+{
+    pthread_mutex_lock( &q->mutex );
+    q->closed = 1;
+    pthread_cond_broadcast( &q->readable );
+    pthread_cond_broadcast( &q->writable );
+    pthread_mutex_unlock( &q->mutex );
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  queue.h
+ *  lua-thumbnailer
+ *
+ *  bounded blocking queue between the pipeline stages.
+ *
+ */
+
+#ifndef ___THUMBNAILER_QUEUE_H___
+#define ___THUMBNAILER_QUEUE_H___
+
+#include <stddef.h>
+
+typedef struct queue_s queue_t;
+
+
+// returns NULL on failure with errno
+queue_t *queue_new( size_t cap );
+
+void queue_free( queue_t *q );
+
+// push the item. blocks while the queue is full.
+// returns -1 if the queue is closed.
+int queue_push( queue_t *q, void *item );
+
+// returns the item in order of push. blocks while the queue is empty.
+// returns NULL if the queue is closed and empty.
+void *queue_pop( queue_t *q );
+
+// wake up the blocked threads. the items pushed before closing can still 
+// be popped.
+void queue_close( queue_t *q );
+
+
+#endif
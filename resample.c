@@ -0,0 +1,820 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  resample.c
+ *  lua-thumbnailer
+ *
+ *  separable ARGB32 resampler with SIMD kernels.
+ *
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include "resample.h"
+#include "bufpool.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define RESAMPLE_X86    1
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI    3.14159265358979323846
+#endif
+
+// fixed point of the weights
+#define PRECISION_BITS  14
+#define PRECISION_ONE   ( 1 << PRECISION_BITS )
+#define PRECISION_ROUND ( 1 << ( PRECISION_BITS - 1 ) )
+
+#define ALPHA_OPAQUE    0xff000000U
+
+
+// MARK: filters
+static double filter_box( double x )
+{
+    return ( x > -0.5 && x <= 0.5 ) ? 1.0 : 0.0;
+}
+
+
+static double filter_bilinear( double x )
+{
+    x = fabs( x );
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+
+static double filter_bicubic( double x )
+{
+    const double a = -0.5;
+    
+    x = fabs( x );
+    if( x < 1.0 ){
+        return ( ( a + 2.0 ) * x - ( a + 3.0 ) ) * x * x + 1.0;
+    }
+    else if( x < 2.0 ){
+        return ( ( ( x - 5.0 ) * x + 8.0 ) * x - 4.0 ) * a;
+    }
+    return 0.0;
+}
+
+
+static inline double sinc( double x )
+{
+    if( x == 0.0 ){
+        return 1.0;
+    }
+    x *= M_PI;
+    return sin( x ) / x;
+}
+
+
+static double filter_lanczos( double x )
+{
+    if( x > -3.0 && x < 3.0 ){
+        return sinc( x ) * sinc( x / 3.0 );
+    }
+    return 0.0;
+}
+
+
+static const struct {
+    const char *name;
+    double (*fn)( double x );
+    double support;
+} FILTERS[] = {
+    [RESAMPLE_IMLIB] = { "imlib", NULL, 0 },
+    [RESAMPLE_BOX] = { "box", filter_box, 0.5 },
+    [RESAMPLE_BILINEAR] = { "bilinear", filter_bilinear, 1.0 },
+    [RESAMPLE_BICUBIC] = { "bicubic", filter_bicubic, 2.0 },
+    [RESAMPLE_LANCZOS] = { "lanczos", filter_lanczos, 3.0 }
+};
+
+#define NFILTERS    ( sizeof( FILTERS ) / sizeof( FILTERS[0] ) )
+
+
+int resample_filter( const char *name )
+{
+    size_t i = 0;
+    
+    for(; i < NFILTERS; i++ ){
+        if( strcasecmp( FILTERS[i].name, name ) == 0 ){
+            return (int)i;
+        }
+    }
+    
+    return -1;
+}
+
+
+const char *resample_filter_name( int filter )
+{
+    if( filter < 0 || (size_t)filter >= NFILTERS ){
+        return NULL;
+    }
+    return FILTERS[filter].name;
+}
+
+
+// MARK: weights
+static void axis_dispose( resample_axis_t *a )
+{
+    free( a->start );
+    free( a->count );
+    free( a->weights );
+    *a = (resample_axis_t){ NULL, NULL, NULL, 0 };
+}
+
+
+static int axis_init( resample_axis_t *a, int filter, int off, int len, 
+                      int out )
+{
+    double (*fn)( double ) = FILTERS[filter].fn;
+    double scale = (double)len / (double)out;
+    double fscale = scale < 1.0 ? 1.0 : scale;
+    double support = FILTERS[filter].support * fscale;
+    double *tmp = NULL;
+    int i = 0;
+    
+    a->max = (int)ceil( support ) * 2 + 1;
+    a->start = malloc( sizeof( int ) * (size_t)out );
+    a->count = malloc( sizeof( int ) * (size_t)out );
+    a->weights = calloc( (size_t)out * (size_t)a->max, sizeof( int16_t ) );
+    tmp = malloc( sizeof( double ) * (size_t)a->max );
+    if( !a->start || !a->count || !a->weights || !tmp ){
+        axis_dispose( a );
+        free( tmp );
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    for(; i < out; i++ )
+    {
+        double center = ( (double)i + 0.5 ) * scale;
+        int lo = (int)floor( center - support + 0.5 );
+        int hi = (int)floor( center + support + 0.5 );
+        int16_t *w = a->weights + (size_t)i * (size_t)a->max;
+        double sum = 0;
+        int total = 0;
+        int peak = 0;
+        int skip = 0;
+        int n = 0;
+        int k = 0;
+        
+        if( lo < 0 ){
+            lo = 0;
+        }
+        if( hi > len ){
+            hi = len;
+        }
+        if( hi - lo > a->max ){
+            hi = lo + a->max;
+        }
+        n = hi - lo;
+        for( k = 0; k < n; k++ ){
+            tmp[k] = fn( ( (double)( lo + k ) - center + 0.5 ) / fscale );
+        }
+        // skip the pixels that do not contribute
+        for(; n > 1 && tmp[n - 1] == 0.0; n-- ){}
+        for(; skip < n - 1 && tmp[skip] == 0.0; skip++ ){}
+        lo += skip;
+        n -= skip;
+        for( k = 0; k < n; k++ ){
+            sum += tmp[skip + k];
+        }
+        
+        if( sum == 0.0 ){
+            w[0] = PRECISION_ONE;
+            n = 1;
+        }
+        else
+        {
+            for( k = 0; k < n; k++ ){
+                w[k] = (int16_t)lround( tmp[skip + k] / sum * PRECISION_ONE );
+                total += w[k];
+                if( abs( w[k] ) > abs( w[peak] ) ){
+                    peak = k;
+                }
+            }
+            // weights of flat color must be exactly one
+            w[peak] = (int16_t)( w[peak] + PRECISION_ONE - total );
+        }
+        a->start[i] = off + lo;
+        a->count[i] = n;
+    }
+    free( tmp );
+    
+    return 0;
+}
+
+
+// MARK: kernels
+// horizontal pass: scale a source row into w pixels
+typedef void (*hpass_t)( uint32_t *out, const uint32_t *in, 
+                         const resample_axis_t *a, int w );
+// vertical pass: blend n rows of the intermediate image into a row
+typedef void (*vpass_t)( uint32_t *out, const uint32_t *rows, size_t stride, 
+                         int n, const int16_t *k, int w );
+
+typedef struct {
+    const char *isa;
+    hpass_t hpass;
+    vpass_t vpass;
+} kernel_t;
+
+
+static inline uint8_t clip8( int32_t v )
+{
+    v >>= PRECISION_BITS;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+
+static inline void pack_c( uint32_t *out, const int32_t *c )
+{
+    uint8_t *p = (uint8_t*)out;
+    
+    p[0] = clip8( c[0] );
+    p[1] = clip8( c[1] );
+    p[2] = clip8( c[2] );
+    p[3] = clip8( c[3] );
+}
+
+
+static void hpass_c( uint32_t *out, const uint32_t *in, 
+                     const resample_axis_t *a, int w )
+{
+    int x = 0;
+    
+    for(; x < w; x++ )
+    {
+        const uint8_t *p = (const uint8_t*)( in + a->start[x] );
+        const int16_t *k = a->weights + (size_t)x * (size_t)a->max;
+        int32_t c[4] = { 
+            PRECISION_ROUND, PRECISION_ROUND, PRECISION_ROUND, PRECISION_ROUND 
+        };
+        int i = 0;
+        
+        for(; i < a->count[x]; i++, p += 4 ){
+            c[0] += p[0] * k[i];
+            c[1] += p[1] * k[i];
+            c[2] += p[2] * k[i];
+            c[3] += p[3] * k[i];
+        }
+        pack_c( out + x, c );
+    }
+}
+
+
+static inline void vpixel_c( uint32_t *out, const uint32_t *rows, 
+                             size_t stride, int n, const int16_t *k )
+{
+    int32_t c[4] = { 
+        PRECISION_ROUND, PRECISION_ROUND, PRECISION_ROUND, PRECISION_ROUND 
+    };
+    int i = 0;
+    
+    for(; i < n; i++ ){
+        const uint8_t *p = (const uint8_t*)( rows + stride * (size_t)i );
+        
+        c[0] += p[0] * k[i];
+        c[1] += p[1] * k[i];
+        c[2] += p[2] * k[i];
+        c[3] += p[3] * k[i];
+    }
+    pack_c( out, c );
+    *out |= ALPHA_OPAQUE;
+}
+
+
+static void vpass_c( uint32_t *out, const uint32_t *rows, size_t stride, 
+                     int n, const int16_t *k, int w )
+{
+    int x = 0;
+    
+    for(; x < w; x++ ){
+        vpixel_c( out + x, rows + x, stride, n, k );
+    }
+}
+
+
+#ifdef RESAMPLE_X86
+
+// a pair of weights for _mm_madd_epi16
+static inline int32_t weight_pair( int16_t w0, int16_t w1 )
+{
+    return (int32_t)( (uint32_t)(uint16_t)w0 | (uint32_t)(uint16_t)w1 << 16 );
+}
+
+
+// interleave the channels of two pixels and sum of products of the weights
+__attribute__((target("sse2")))
+static inline __m128i hpair_sse2( const uint32_t *p, int32_t pair, 
+                                  uint32_t p1 )
+{
+    __m128i pix = _mm_unpacklo_epi8( _mm_cvtsi32_si128( (int)p[0] ), 
+                                     _mm_cvtsi32_si128( (int)p1 ) );
+    
+    pix = _mm_unpacklo_epi8( pix, _mm_setzero_si128() );
+    return _mm_madd_epi16( pix, _mm_set1_epi32( pair ) );
+}
+
+
+__attribute__((target("sse2")))
+static inline uint32_t hpack_sse2( __m128i acc )
+{
+    acc = _mm_srai_epi32( acc, PRECISION_BITS );
+    acc = _mm_packs_epi32( acc, acc );
+    return (uint32_t)_mm_cvtsi128_si32( _mm_packus_epi16( acc, acc ) );
+}
+
+
+__attribute__((target("sse2")))
+static inline __m128i htail_sse2( __m128i acc, const uint32_t *p, 
+                                  const int16_t *k, int i, int n )
+{
+    for(; i + 1 < n; i += 2 ){
+        acc = _mm_add_epi32( acc, hpair_sse2( p + i, 
+                                              weight_pair( k[i], k[i + 1] ), 
+                                              p[i + 1] ) );
+    }
+    if( i < n ){
+        acc = _mm_add_epi32( acc, hpair_sse2( p + i, 
+                                              weight_pair( k[i], 0 ), 0 ) );
+    }
+    
+    return acc;
+}
+
+
+__attribute__((target("sse2")))
+static void hpass_sse2( uint32_t *out, const uint32_t *in, 
+                        const resample_axis_t *a, int w )
+{
+    int x = 0;
+    
+    for(; x < w; x++ )
+    {
+        const int16_t *k = a->weights + (size_t)x * (size_t)a->max;
+        __m128i acc = htail_sse2( _mm_set1_epi32( PRECISION_ROUND ), 
+                                  in + a->start[x], k, 0, a->count[x] );
+        
+        out[x] = hpack_sse2( acc );
+    }
+}
+
+
+// blend 4 pixels of two rows
+__attribute__((target("sse2")))
+static inline void vquad_sse2( __m128i *acc, __m128i a, __m128i b, 
+                               int32_t pair )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i wt = _mm_set1_epi32( pair );
+    __m128i lo = _mm_unpacklo_epi8( a, b );
+    __m128i hi = _mm_unpackhi_epi8( a, b );
+    
+    acc[0] = _mm_add_epi32( acc[0], 
+                            _mm_madd_epi16( _mm_unpacklo_epi8( lo, zero ), wt ) );
+    acc[1] = _mm_add_epi32( acc[1], 
+                            _mm_madd_epi16( _mm_unpackhi_epi8( lo, zero ), wt ) );
+    acc[2] = _mm_add_epi32( acc[2], 
+                            _mm_madd_epi16( _mm_unpacklo_epi8( hi, zero ), wt ) );
+    acc[3] = _mm_add_epi32( acc[3], 
+                            _mm_madd_epi16( _mm_unpackhi_epi8( hi, zero ), wt ) );
+}
+
+
+__attribute__((target("sse2")))
+static inline __m128i vpack_sse2( __m128i *acc )
+{
+    __m128i lo = _mm_packs_epi32( _mm_srai_epi32( acc[0], PRECISION_BITS ), 
+                                  _mm_srai_epi32( acc[1], PRECISION_BITS ) );
+    __m128i hi = _mm_packs_epi32( _mm_srai_epi32( acc[2], PRECISION_BITS ), 
+                                  _mm_srai_epi32( acc[3], PRECISION_BITS ) );
+    
+    return _mm_or_si128( _mm_packus_epi16( lo, hi ), 
+                         _mm_set1_epi32( (int)ALPHA_OPAQUE ) );
+}
+
+
+__attribute__((target("sse2")))
+static void vpass_sse2( uint32_t *out, const uint32_t *rows, size_t stride, 
+                        int n, const int16_t *k, int w )
+{
+    int x = 0;
+    
+    for(; x + 4 <= w; x += 4 )
+    {
+        const uint32_t *p = rows + x;
+        __m128i acc[4];
+        int i = 0;
+        
+        acc[0] = acc[1] = acc[2] = acc[3] = _mm_set1_epi32( PRECISION_ROUND );
+        for(; i + 1 < n; i += 2, p += stride * 2 ){
+            vquad_sse2( acc, _mm_loadu_si128( (const __m128i*)p ), 
+                        _mm_loadu_si128( (const __m128i*)( p + stride ) ), 
+                        weight_pair( k[i], k[i + 1] ) );
+        }
+        if( i < n ){
+            vquad_sse2( acc, _mm_loadu_si128( (const __m128i*)p ), 
+                        _mm_setzero_si128(), weight_pair( k[i], 0 ) );
+        }
+        _mm_storeu_si128( (__m128i*)( out + x ), vpack_sse2( acc ) );
+    }
+    for(; x < w; x++ ){
+        vpixel_c( out + x, rows + x, stride, n, k );
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void hpass_avx2( uint32_t *out, const uint32_t *in, 
+                        const resample_axis_t *a, int w )
+{
+    // interleave the channels of pixel 0 and 1, 2 and 3
+    const __m128i shuf = _mm_setr_epi8( 0, 4, 1, 5, 2, 6, 3, 7, 
+                                        8, 12, 9, 13, 10, 14, 11, 15 );
+    int x = 0;
+    
+    for(; x < w; x++ )
+    {
+        const uint32_t *p = in + a->start[x];
+        const int16_t *k = a->weights + (size_t)x * (size_t)a->max;
+        int n = a->count[x];
+        __m256i acc4 = _mm256_setzero_si256();
+        __m128i acc = _mm_set1_epi32( PRECISION_ROUND );
+        int i = 0;
+        
+        for(; i + 3 < n; i += 4 )
+        {
+            __m128i pix = _mm_shuffle_epi8( 
+                _mm_loadu_si128( (const __m128i*)( p + i ) ), shuf 
+            );
+            int32_t w01 = weight_pair( k[i], k[i + 1] );
+            int32_t w23 = weight_pair( k[i + 2], k[i + 3] );
+            
+            acc4 = _mm256_add_epi32( acc4, _mm256_madd_epi16( 
+                _mm256_cvtepu8_epi16( pix ), 
+                _mm256_setr_epi32( w01, w01, w01, w01, w23, w23, w23, w23 ) 
+            ) );
+        }
+        acc = _mm_add_epi32( acc, _mm256_castsi256_si128( acc4 ) );
+        acc = _mm_add_epi32( acc, _mm256_extracti128_si256( acc4, 1 ) );
+        out[x] = hpack_sse2( htail_sse2( acc, p, k, i, n ) );
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void vpass_avx2( uint32_t *out, const uint32_t *rows, size_t stride, 
+                        int n, const int16_t *k, int w )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    
+    for(; x + 8 <= w; x += 8 )
+    {
+        const uint32_t *p = rows + x;
+        __m256i acc[4];
+        __m256i lo, hi;
+        int i = 0;
+        
+        acc[0] = acc[1] = acc[2] = acc[3] = 
+            _mm256_set1_epi32( PRECISION_ROUND );
+        for(; i < n; i++, p += stride )
+        {
+            __m256i a = _mm256_loadu_si256( (const __m256i*)p );
+            __m256i b = zero;
+            __m256i wt;
+            
+            if( i + 1 < n ){
+                b = _mm256_loadu_si256( (const __m256i*)( p + stride ) );
+                wt = _mm256_set1_epi32( weight_pair( k[i], k[i + 1] ) );
+                i++;
+                p += stride;
+            }
+            else {
+                wt = _mm256_set1_epi32( weight_pair( k[i], 0 ) );
+            }
+            // pixel 0, 1 | 4, 5 and 2, 3 | 6, 7
+            lo = _mm256_unpacklo_epi8( a, b );
+            hi = _mm256_unpackhi_epi8( a, b );
+            acc[0] = _mm256_add_epi32( acc[0], _mm256_madd_epi16( 
+                _mm256_unpacklo_epi8( lo, zero ), wt ) );
+            acc[1] = _mm256_add_epi32( acc[1], _mm256_madd_epi16( 
+                _mm256_unpackhi_epi8( lo, zero ), wt ) );
+            acc[2] = _mm256_add_epi32( acc[2], _mm256_madd_epi16( 
+                _mm256_unpacklo_epi8( hi, zero ), wt ) );
+            acc[3] = _mm256_add_epi32( acc[3], _mm256_madd_epi16( 
+                _mm256_unpackhi_epi8( hi, zero ), wt ) );
+        }
+        lo = _mm256_packs_epi32( _mm256_srai_epi32( acc[0], PRECISION_BITS ), 
+                                 _mm256_srai_epi32( acc[1], PRECISION_BITS ) );
+        hi = _mm256_packs_epi32( _mm256_srai_epi32( acc[2], PRECISION_BITS ), 
+                                 _mm256_srai_epi32( acc[3], PRECISION_BITS ) );
+        _mm256_storeu_si256( (__m256i*)( out + x ), _mm256_or_si256( 
+            _mm256_packus_epi16( lo, hi ), 
+            _mm256_set1_epi32( (int)ALPHA_OPAQUE ) 
+        ) );
+    }
+    vpass_sse2( out + x, rows + x, stride, n, k, w - x );
+}
+
+#endif
+
+
+static const kernel_t KERNEL_C = { "c", hpass_c, vpass_c };
+#ifdef RESAMPLE_X86
+static const kernel_t KERNEL_SSE2 = { "sse2", hpass_sse2, vpass_sse2 };
+static const kernel_t KERNEL_AVX2 = { "avx2", hpass_avx2, vpass_avx2 };
+#endif
+
+
+// all kernels produce the same result
+static const kernel_t *kernel_select( void )
+{
+#ifdef RESAMPLE_X86
+    if( __builtin_cpu_supports( "avx2" ) ){
+        return &KERNEL_AVX2;
+    }
+    else if( __builtin_cpu_supports( "sse2" ) ){
+        return &KERNEL_SSE2;
+    }
+#endif
+    return &KERNEL_C;
+}
+
+
+const char *resample_isa( void )
+{
+    return kernel_select()->isa;
+}
+
+
+// MARK: resample
+int resample_init( resample_t *r, uint32_t *dst, int dstride, int w, int h, 
+                   const uint32_t *src, int stride, int sx, int sy, int sw, 
+                   int sh, int filter )
+{
+    if( w < 1 || h < 1 || dstride < w || sw < 1 || sh < 1 || filter <= RESAMPLE_IMLIB || 
+        (size_t)filter >= NFILTERS ){
+        errno = EINVAL;
+        return -1;
+    }
+    
+    *r = (resample_t){
+        .src = src,
+        .stride = stride,
+        .dst = dst,
+        .dstride = dstride,
+        .w = w,
+        .h = h
+    };
+    if( axis_init( &r->x, filter, sx, sw, w ) != 0 ){
+        return -1;
+    }
+    else if( axis_init( &r->y, filter, sy, sh, h ) != 0 ){
+        axis_dispose( &r->x );
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+void resample_dispose( resample_t *r )
+{
+    axis_dispose( &r->x );
+    axis_dispose( &r->y );
+}
+
+
+int resample_rows( resample_t *r, int y0, int y1 )
+{
+    const kernel_t *kernel = kernel_select();
+    size_t w = (size_t)r->w;
+    uint32_t *tmp = NULL;
+    size_t bytes = 0;
+    int top = INT_MAX;
+    int bottom = 0;
+    int y = y0;
+    
+    // source rows of the destination rows
+    for(; y < y1; y++ )
+    {
+        if( r->y.start[y] < top ){
+            top = r->y.start[y];
+        }
+        if( r->y.start[y] + r->y.count[y] > bottom ){
+            bottom = r->y.start[y] + r->y.count[y];
+        }
+    }
+    if( y0 >= y1 ){
+        return 0;
+    }
+    
+    bytes = sizeof( uint32_t ) * w * (size_t)( bottom - top );
+    if( !( tmp = bufpool_alloc( bytes ) ) ){
+        return -1;
+    }
+    
+    for( y = top; y < bottom; y++ ){
+        kernel->hpass( tmp + w * (size_t)( y - top ), 
+                       r->src + (size_t)r->stride * (size_t)y, &r->x, r->w );
+    }
+    for( y = y0; y < y1; y++ ){
+        kernel->vpass( r->dst + (size_t)r->dstride * (size_t)y, 
+                       tmp + w * (size_t)( r->y.start[y] - top ), w, 
+                       r->y.count[y], 
+                       r->y.weights + (size_t)y * (size_t)r->y.max, r->w );
+    }
+    bufpool_free( tmp, bytes );
+    
+    return 0;
+}
+
+
+int resample_argb32( uint32_t *dst, int w, int h, const uint32_t *src, 
+                     int stride, int sx, int sy, int sw, int sh, int filter )
+{
+    resample_t r;
+    int rc = resample_init( &r, dst, w, w, h, src, stride, sx, sy, sw, sh, 
+                            filter );
+    
+    if( rc == 0 ){
+        rc = resample_rows( &r, 0, h );
+        resample_dispose( &r );
+    }
+    
+    return rc;
+}
+
+
+// MARK: stream
+struct resample_stream_s {
+    uint32_t *dst;
+    int w;
+    int h;
+    int sw;
+    int sh;
+    // next source row and destination row
+    int sy;
+    int y;
+    // weighted sums of ARGB channels of the source row and the destination row
+    uint64_t *hsum;
+    uint64_t *vsum;
+};
+
+
+resample_stream_t *resample_stream_new( uint32_t *dst, int w, int h, int sw, 
+                                        int sh )
+{
+    resample_stream_t *s = NULL;
+    
+    if( w < 1 || h < 1 || w > sw || h > sh ){
+        errno = EINVAL;
+        return NULL;
+    }
+    // sums must not overflow
+    else if( (uint64_t)sw * (uint64_t)sh > UINT64_MAX / 256 ){
+        errno = E2BIG;
+        return NULL;
+    }
+    else if( !( s = calloc( 1, sizeof( resample_stream_t ) ) ) ){
+        errno = ENOMEM;
+        return NULL;
+    }
+    else if( !( s->hsum = calloc( (size_t)w * 4, sizeof( uint64_t ) ) ) || 
+             !( s->vsum = calloc( (size_t)w * 4, sizeof( uint64_t ) ) ) ){
+        resample_stream_free( s );
+        errno = ENOMEM;
+        return NULL;
+    }
+    s->dst = dst;
+    s->w = w;
+    s->h = h;
+    s->sw = sw;
+    s->sh = sh;
+    
+    return s;
+}
+
+
+void resample_stream_free( resample_stream_t *s )
+{
+    if( s ){
+        free( s->hsum );
+        free( s->vsum );
+        free( s );
+    }
+}
+
+
+// sum the source pixels that overlap each destination column. a source 
+// pixel covers [sx * w, (sx + 1) * w) and a destination pixel covers 
+// [x * sw, (x + 1) * sw) in the same units.
+static void stream_hsum( resample_stream_t *s, const uint32_t *row )
+{
+    uint64_t *sum = s->hsum;
+    int64_t w = s->w;
+    int64_t sw = s->sw;
+    int64_t lo = 0;
+    int64_t end = sw;
+    int64_t n = 0;
+    int sx = 0;
+    
+    memset( sum, 0, sizeof( uint64_t ) * 4 * (size_t)w );
+    for(; sx < s->sw; sx++ )
+    {
+        uint32_t px = row[sx];
+        int64_t hi = lo + w;
+        
+        while( lo < hi )
+        {
+            n = ( hi < end ? hi : end ) - lo;
+            sum[0] += (uint64_t)( px >> 24 ) * (uint64_t)n;
+            sum[1] += (uint64_t)( px >> 16 & 0xff ) * (uint64_t)n;
+            sum[2] += (uint64_t)( px >> 8 & 0xff ) * (uint64_t)n;
+            sum[3] += (uint64_t)( px & 0xff ) * (uint64_t)n;
+            lo += n;
+            if( lo == end ){
+                sum += 4;
+                end += sw;
+            }
+        }
+    }
+}
+
+
+static void stream_flush( resample_stream_t *s )
+{
+    uint32_t *out = s->dst + (size_t)s->w * (size_t)s->y;
+    uint64_t area = (uint64_t)s->sw * (uint64_t)s->sh;
+    uint64_t *sum = s->vsum;
+    int x = 0;
+    
+    for(; x < s->w; x++, sum += 4 ){
+        out[x] = (uint32_t)( ( sum[0] + area / 2 ) / area ) << 24 | 
+                 (uint32_t)( ( sum[1] + area / 2 ) / area ) << 16 | 
+                 (uint32_t)( ( sum[2] + area / 2 ) / area ) << 8 | 
+                 (uint32_t)( ( sum[3] + area / 2 ) / area );
+    }
+    memset( s->vsum, 0, sizeof( uint64_t ) * 4 * (size_t)s->w );
+}
+
+
+void resample_stream_row( resample_stream_t *s, const uint32_t *row )
+{
+    size_t len = (size_t)s->w * 4;
+    int64_t lo = (int64_t)s->sy * s->h;
+    int64_t hi = lo + s->h;
+    int64_t end = (int64_t)( s->y + 1 ) * s->sh;
+    int64_t n = 0;
+    size_t i = 0;
+    
+    if( s->y >= s->h ){
+        return;
+    }
+    
+    stream_hsum( s, row );
+    // add the source row to the destination rows that it overlaps
+    while( lo < hi )
+    {
+        n = ( hi < end ? hi : end ) - lo;
+        for( i = 0; i < len; i++ ){
+            s->vsum[i] += s->hsum[i] * (uint64_t)n;
+        }
+        lo += n;
+        if( lo == end ){
+            stream_flush( s );
+            s->y++;
+            end += s->sh;
+        }
+    }
+    s->sy++;
+}
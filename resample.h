@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  resample.h
+ *  lua-thumbnailer
+ *
+ *  separable ARGB32 resampler with SIMD kernels.
+ *
+ */
+
+#ifndef ___THUMBNAILER_RESAMPLE_H___
+#define ___THUMBNAILER_RESAMPLE_H___
+
+#include <stdint.h>
+
+enum resample_filter_e {
+    // scale by imlib2
+    RESAMPLE_IMLIB = 0,
+    RESAMPLE_BOX,
+    RESAMPLE_BILINEAR,
+    RESAMPLE_BICUBIC,
+    RESAMPLE_LANCZOS
+};
+
+
+// contributions of the source pixels to each destination pixel of one axis
+typedef struct {
+    // first source index of each destination index
+    int *start;
+    // number of source pixels of each destination index
+    int *count;
+    // fixed point weights. row of each destination index has max elements
+    int16_t *weights;
+    int max;
+} resample_axis_t;
+
+
+typedef struct {
+    const uint32_t *src;
+    // row length of the source pixels
+    int stride;
+    uint32_t *dst;
+    // row length of the destination pixels
+    int dstride;
+    int w;
+    int h;
+    resample_axis_t x;
+    resample_axis_t y;
+} resample_t;
+
+
+// returns the filter value of name, or -1 if name is unknown
+int resample_filter( const char *name );
+
+// returns the name of the filter value
+const char *resample_filter_name( int filter );
+
+// returns the name of the SIMD kernels selected at runtime
+const char *resample_isa( void );
+
+// prepare to scale the area (sx, sy, sw, sh) of the source pixels to w x h 
+// destination pixels. the destination can be a part of the larger frame 
+// that row length is dstride.
+// returns 0 on success, or -1 on failure with errno.
+int resample_init( resample_t *r, uint32_t *dst, int dstride, int w, int h, 
+                   const uint32_t *src, int stride, int sx, int sy, int sw, 
+                   int sh, int filter );
+
+// render the destination rows from y0 to y1 (exclusive). a pixel of the 
+// result does not depend on the range of the rows, so the range can be 
+// rendered separately.
+// returns 0 on success, or -1 on failure with errno.
+int resample_rows( resample_t *r, int y0, int y1 );
+
+void resample_dispose( resample_t *r );
+
+// the source is treated as the opaque image. alpha of the result is 0xff.
+// returns 0 on success, or -1 on failure with errno.
+int resample_argb32( uint32_t *dst, int w, int h, const uint32_t *src, 
+                     int stride, int sx, int sy, int sw, int sh, int filter );
+
+
+// reduces the source rows that pushed from top to bottom by the area 
+// average without holding the whole source image.
+typedef struct resample_stream_s resample_stream_t;
+
+// create the stream that reduces sw x sh source pixels to w x h destination 
+// pixels. w and h must not be larger than sw and sh.
+// returns NULL on failure with errno.
+resample_stream_t *resample_stream_new( uint32_t *dst, int w, int h, int sw, 
+                                        int sh );
+
+// push the next source row of sw pixels
+void resample_stream_row( resample_stream_t *s, const uint32_t *row );
+
+void resample_stream_free( resample_stream_t *s );
+
+
+#endif
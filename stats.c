@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  stats.c
+ *  lua-thumbnailer
+ *
+ *  per-stage and per-operation timings and counters.
+ *
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+// counters are updated by atomic operations. format slots are named under 
+// the lock.
+static stats_t STATS;
+static pthread_mutex_t STATS_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *STAGE_NAMES[STATS_NSTAGE] = {
+    "decode", "wrap", "scale", "compose", "encode", "write"
+};
+
+static const char *OP_NAMES[STATS_NOP] = {
+    "load", "loadBuffer", "read", 
+    "save", "saveCrop", "saveTrim", "saveAspect",
+    "encode", "encodeCrop", "encodeTrim", "encodeAspect",
+    "atlas"
+};
+
+
+uint64_t stats_now( void )
+{
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static void timer_add( stats_timer_t *t, uint64_t ns )
+{
+    uint64_t usec = ns / 1000;
+    uint64_t max = __atomic_load_n( &t->max_ns, __ATOMIC_RELAXED );
+    int bucket = 0;
+    
+    for(; usec > 1 && bucket < STATS_NBUCKET - 1; usec >>= 1 ){
+        bucket++;
+    }
+    __atomic_add_fetch( &t->count, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &t->ns, ns, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &t->hist[bucket], 1, __ATOMIC_RELAXED );
+    while( ns > max && 
+           !__atomic_compare_exchange_n( &t->max_ns, &max, ns, 0, 
+                                         __ATOMIC_RELAXED, 
+                                         __ATOMIC_RELAXED ) ){}
+}
+
+
+void stats_stage( int stage, uint64_t start )
+{
+    timer_add( &STATS.stages[stage], stats_now() - start );
+}
+
+
+// returns the slot of the format, or the last slot if slots are exhausted
+static stats_format_t *format_slot( stats_format_t *slots, const char *name )
+{
+    stats_format_t *slot = NULL;
+    int i = 0;
+    
+    if( !name || !*name || strlen( name ) >= STATS_FORMAT_LEN ){
+        name = "unknown";
+    }
+    
+    // slot names are never changed once they are set
+    for(; i < STATS_NFORMAT; i++ )
+    {
+        slot = &slots[i];
+        if( !__atomic_load_n( &slot->name[0], __ATOMIC_ACQUIRE ) ){
+            break;
+        }
+        else if( strcasecmp( slot->name, name ) == 0 ){
+            return slot;
+        }
+    }
+    
+    pthread_mutex_lock( &STATS_MUTEX );
+    for( i = 0; i < STATS_NFORMAT; i++ )
+    {
+        slot = &slots[i];
+        if( !slot->name[0] ){
+            size_t len = strlen( name );
+            
+            memcpy( slot->name + 1, name + 1, len );
+            __atomic_store_n( &slot->name[0], name[0], __ATOMIC_RELEASE );
+            break;
+        }
+        else if( strcasecmp( slot->name, name ) == 0 ){
+            break;
+        }
+    }
+    pthread_mutex_unlock( &STATS_MUTEX );
+    
+    return slot;
+}
+
+
+void stats_op( int op, const char *format, uint64_t start, size_t in, 
+               size_t out, int errnum )
+{
+    stats_format_t *slot = format_slot( STATS.ops[op], format );
+    
+    timer_add( &slot->timer, stats_now() - start );
+    __atomic_add_fetch( &slot->bytes_in, in, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &slot->bytes_out, out, __ATOMIC_RELAXED );
+    if( errnum )
+    {
+        if( errnum < 0 || errnum > STATS_MAX_ERRNO ){
+            errnum = STATS_MAX_ERRNO;
+        }
+        __atomic_add_fetch( &slot->errors, 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &STATS.errnos[errnum], 1, __ATOMIC_RELAXED );
+    }
+}
+
+
+static inline uint64_t counter_take( uint64_t *v, int reset )
+{
+    if( reset ){
+        return __atomic_exchange_n( v, 0, __ATOMIC_RELAXED );
+    }
+    return __atomic_load_n( v, __ATOMIC_RELAXED );
+}
+
+
+static void timer_take( stats_timer_t *dst, stats_timer_t *t, int reset )
+{
+    int i = 0;
+    
+    dst->count = counter_take( &t->count, reset );
+    dst->ns = counter_take( &t->ns, reset );
+    dst->max_ns = counter_take( &t->max_ns, reset );
+    for(; i < STATS_NBUCKET; i++ ){
+        dst->hist[i] = counter_take( &t->hist[i], reset );
+    }
+}
+
+
+void stats_snapshot( stats_t *dst, int reset )
+{
+    int i, j;
+    
+    for( i = 0; i < STATS_NSTAGE; i++ ){
+        timer_take( &dst->stages[i], &STATS.stages[i], reset );
+    }
+    
+    pthread_mutex_lock( &STATS_MUTEX );
+    for( i = 0; i < STATS_NOP; i++ )
+    {
+        for( j = 0; j < STATS_NFORMAT; j++ )
+        {
+            stats_format_t *slot = &STATS.ops[i][j];
+            stats_format_t *copy = &dst->ops[i][j];
+            
+            memcpy( copy->name, slot->name, STATS_FORMAT_LEN );
+            copy->errors = counter_take( &slot->errors, reset );
+            copy->bytes_in = counter_take( &slot->bytes_in, reset );
+            copy->bytes_out = counter_take( &slot->bytes_out, reset );
+            timer_take( &copy->timer, &slot->timer, reset );
+        }
+    }
+    pthread_mutex_unlock( &STATS_MUTEX );
+    
+    for( i = 0; i <= STATS_MAX_ERRNO; i++ ){
+        dst->errnos[i] = counter_take( &STATS.errnos[i], reset );
+    }
+}
+
+
+const char *stats_stage_name( int stage )
+{
+    return STAGE_NAMES[stage];
+}
+
+
+const char *stats_op_name( int op )
+{
+    return OP_NAMES[op];
+}
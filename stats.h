@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  stats.h
+ *  lua-thumbnailer
+ *
+ *  per-stage and per-operation timings and counters.
+ *
+ */
+
+#ifndef ___THUMBNAILER_STATS_H___
+#define ___THUMBNAILER_STATS_H___
+
+#include <stdint.h>
+#include <stddef.h>
+
+// processing stages
+enum stats_stage_e {
+    STATS_DECODE = 0,
+    STATS_WRAP,
+    STATS_SCALE,
+    STATS_COMPOSE,
+    STATS_ENCODE,
+    STATS_WRITE,
+    STATS_NSTAGE
+};
+
+// operations. export operations are ordered by the export mode.
+enum stats_op_e {
+    STATS_LOAD = 0,
+    STATS_LOAD_BUFFER,
+    STATS_READ,
+    STATS_SAVE,
+    STATS_SAVE_CROP,
+    STATS_SAVE_TRIM,
+    STATS_SAVE_ASPECT,
+    STATS_ENCODE_STRETCH,
+    STATS_ENCODE_CROP,
+    STATS_ENCODE_TRIM,
+    STATS_ENCODE_ASPECT,
+    STATS_ATLAS,
+    STATS_NOP
+};
+
+// histogram bucket i counts the durations of 2^i to 2^(i+1) microseconds
+#define STATS_NBUCKET   24
+// max number of formats per operation
+#define STATS_NFORMAT   16
+#define STATS_FORMAT_LEN    16
+// errno that larger than this value is counted as this value
+#define STATS_MAX_ERRNO 255
+
+typedef struct {
+    uint64_t count;
+    uint64_t ns;
+    uint64_t max_ns;
+    uint64_t hist[STATS_NBUCKET];
+} stats_timer_t;
+
+
+typedef struct {
+    char name[STATS_FORMAT_LEN];
+    uint64_t errors;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    stats_timer_t timer;
+} stats_format_t;
+
+
+typedef struct {
+    stats_timer_t stages[STATS_NSTAGE];
+    stats_format_t ops[STATS_NOP][STATS_NFORMAT];
+    uint64_t errnos[STATS_MAX_ERRNO + 1];
+} stats_t;
+
+
+// monotonic clock in nanoseconds
+uint64_t stats_now( void );
+
+// add the elapsed time since the start time to the stage
+void stats_stage( int stage, uint64_t start );
+
+// add the elapsed time since the start time and the bytes to the operation.
+// errnum is errno on failure or 0.
+void stats_op( int op, const char *format, uint64_t start, size_t in, 
+               size_t out, int errnum );
+
+// copy the stats into dst, and reset the stats if reset is non-zero
+void stats_snapshot( stats_t *dst, int reset );
+
+const char *stats_stage_name( int stage );
+const char *stats_op_name( int op );
+
+
+#endif
@@ -28,11 +28,44 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <Imlib2.h>
 #include <lauxlib.h>
+#include "img.h"
+#include "pool.h"
+#include "queue.h"
+#include "probe.h"
+#include "resample.h"
+#include "stats.h"
+#include "cache.h"
+#include "outcache.h"
+#include "bufpool.h"
+#include "fingerprint.h"
+
+
+
+// compatibility with lua 5.2 and later
+#if LUA_VERSION_NUM >= 502
+#define lstate_rawlen(L,idx)        lua_rawlen(L,idx)
+#define lstate_setuservalue(L,idx)  lua_setuservalue(L,idx)
+#else
+#define lstate_rawlen(L,idx)        lua_objlen(L,idx)
+#define lstate_setuservalue(L,idx)  lua_setfenv(L,idx)
+#endif
+
+#if LUA_VERSION_NUM >= 503 && !defined(luaL_checkint)
+#define luaL_checkint(L,n)      ((int)luaL_checkinteger(L,n))
+#define luaL_optint(L,n,d)      ((int)luaL_optinteger(L,n,d))
+#endif
 
 
 // helper macros for lua_State
@@ -48,452 +81,1776 @@
     lua_rawset(L,-3); \
 }while(0)
 
+#define lstate_str2tbl(L,k,v) do{ \
+    lua_pushstring(L,k); \
+    lua_pushstring(L,v); \
+    lua_rawset(L,-3); \
+}while(0)
+
 
 // MARK: lua binding
 #define MODULE_MT   "thumbnailer"
+#define POOL_MT     "thumbnailer.pool"
+#define RUN_MT      "thumbnailer.run"
 
-// default file format
-#define DEFAULT_FORMAT  "png"
-#define MAX_FORMAT_LEN  15
 
+static inline uint8_t check_halign( lua_State *L, int idx )
+{
+    int halign = luaL_checkint( L, idx );
+    
+    if( halign < IMG_ALIGN_LEFT || halign > IMG_ALIGN_RIGHT ){
+        return luaL_argerror( L, idx, "horizontal align must be LEFT, RIGHT or CENTER" );
+    }
+    
+    return (uint8_t)halign;
+}
 
-enum img_align_e {
-    IMG_ALIGN_NONE = 0,
-    IMG_ALIGN_LEFT,
-    IMG_ALIGN_CENTER,
-    IMG_ALIGN_RIGHT,
-    IMG_ALIGN_TOP,
-    IMG_ALIGN_MIDDLE,
-    IMG_ALIGN_BOTTOM
-};
 
-typedef struct {
-    int w;
-    int h;
-} img_size_t;
+static inline uint8_t check_valign( lua_State *L, int idx )
+{
+    int valign = luaL_checkint( L, idx );
+    
+    if( valign < IMG_ALIGN_TOP || valign > IMG_ALIGN_BOTTOM ){
+        return luaL_argerror( L, idx, "vertical align must be TOP, BOTTOM or MIDDLE" );
+    }
+    
+    return (uint8_t)valign;
+}
 
 
-typedef struct {
-    int x;
-    int y;
-    int w;
-    int h;
-} img_bounds_t;
+// check destination argument that path string or file descriptor
+static void check_dest( lua_State *L, int idx, img_dest_t *dest )
+{
+    *dest = (img_dest_t){ NULL, -1, NULL };
+    if( lua_type( L, idx ) == LUA_TNUMBER )
+    {
+        lua_Integer fd = lua_tointeger( L, idx );
+        
+        if( fd < 0 || fd > INT_MAX ){
+            luaL_argerror( L, idx, "fd must be larger than or equal to 0" );
+        }
+        dest->fd = (int)fd;
+    }
+    else {
+        dest->path = luaL_checkstring( L, idx );
+    }
+}
+
+
+// check optional arguments of export mode
+static void check_spec_args( lua_State *L, int idx, img_spec_t *spec )
+{
+    switch( spec->mode )
+    {
+        case IMG_MODE_CROP:
+            // check alignment arguments
+            // horizontal
+            if( !lua_isnoneornil( L, idx ) ){
+                spec->halign = check_halign( L, idx );
+            }
+            // vertical
+            if( !lua_isnoneornil( L, idx + 1 ) ){
+                spec->valign = check_valign( L, idx + 1 );
+            }
+        break;
+        
+        case IMG_MODE_ASPECT:
+            // hue
+            if( !lua_isnoneornil( L, idx ) ){
+                lua_Number arg = luaL_checknumber( L, idx );
+                SETVAL_IN_RANGE( spec->hue, float, arg, 0, 360 );
+            }
+            // saturation
+            if( !lua_isnoneornil( L, idx + 1 ) ){
+                lua_Number arg = luaL_checknumber( L, idx + 1 );
+                SETVAL_IN_RANGE( spec->saturation, float, arg, 0, 1 );
+            }
+            // lightness
+            if( !lua_isnoneornil( L, idx + 2 ) ){
+                lua_Number arg = luaL_checknumber( L, idx + 2 );
+                SETVAL_IN_RANGE( spec->lightness, float, arg, 0, 1 );
+            }
+            // alpha
+            if( !lua_isnoneornil( L, idx + 3 ) ){
+                lua_Integer arg = luaL_checkinteger( L, idx + 3 );
+                SETVAL_IN_RANGE( spec->alpha, int, arg, 0, 255 );
+            }
+            // horizontal
+            if( !lua_isnoneornil( L, idx + 4 ) ){
+                spec->halign = check_halign( L, idx + 4 );
+            }
+            // vertical
+            if( !lua_isnoneornil( L, idx + 5 ) ){
+                spec->valign = check_valign( L, idx + 5 );
+            }
+        break;
+    }
+}
+
+
+// returns the index of the value at the top of the stack in names, or -1
+static int check_name( lua_State *L, const char *const names[] )
+{
+    const char *name = lua_isstring( L, -1 ) ? lua_tostring( L, -1 ) : "";
+    int i = 0;
+    
+    for(; names[i]; i++ ){
+        if( strcmp( name, names[i] ) == 0 ){
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+
+// check the options of the native encoders in the table at idx.
+// returns NULL, or the name of the invalid option.
+static const char *check_encode_opts( lua_State *L, int idx, 
+                                      codec_opts_t *opts )
+{
+    static const char *const subsampling[] = { 
+        "", "444", "422", "420", NULL 
+    };
+    static const char *const dct[] = { 
+        "", "accurate", "fast", "float", NULL 
+    };
+    static const char *const filter[] = { 
+        "", "none", "sub", "up", "avg", "paeth", "all", NULL 
+    };
+    int v = 0;
+    
+    // jpeg
+    lua_getfield( L, idx, "subsampling" );
+    if( !lua_isnil( L, -1 ) ){
+        if( ( v = check_name( L, subsampling ) ) < 1 ){
+            return "subsampling";
+        }
+        opts->subsampling = (uint8_t)v;
+    }
+    lua_getfield( L, idx, "progressive" );
+    if( !lua_isnil( L, -1 ) ){
+        opts->progressive = (uint8_t)lua_toboolean( L, -1 );
+    }
+    lua_getfield( L, idx, "optimize" );
+    if( !lua_isnil( L, -1 ) ){
+        opts->optimize = (uint8_t)lua_toboolean( L, -1 );
+    }
+    lua_getfield( L, idx, "dct" );
+    if( !lua_isnil( L, -1 ) ){
+        if( ( v = check_name( L, dct ) ) < 1 ){
+            return "dct";
+        }
+        opts->dct = (uint8_t)v;
+    }
+    // png
+    lua_getfield( L, idx, "level" );
+    if( !lua_isnil( L, -1 ) ){
+        if( !lua_isnumber( L, -1 ) || ( v = (int)lua_tointeger( L, -1 ) ) < 0 || 
+            v > 9 ){
+            return "level";
+        }
+        opts->level = (uint8_t)( v + 1 );
+    }
+    lua_getfield( L, idx, "png_filter" );
+    if( !lua_isnil( L, -1 ) ){
+        if( ( v = check_name( L, filter ) ) < 1 ){
+            return "png_filter";
+        }
+        opts->filter = (uint8_t)v;
+    }
+    // webp
+    lua_getfield( L, idx, "lossless" );
+    if( !lua_isnil( L, -1 ) ){
+        opts->lossless = (uint8_t)lua_toboolean( L, -1 );
+    }
+    // lossy encoders
+    lua_getfield( L, idx, "max_bytes" );
+    if( !lua_isnil( L, -1 ) )
+    {
+        lua_Number n = lua_tonumber( L, -1 );
+        
+        if( !lua_isnumber( L, -1 ) || n < 0 || n > (lua_Number)SIZE_MAX ){
+            return "max_bytes";
+        }
+        opts->max_bytes = (size_t)n;
+    }
+    lua_pop( L, 8 );
+    
+    return NULL;
+}
+
+
+// check the trailing options table of the encoders after the arguments 
+// from idx, and remove it from the stack
+static void check_export_opts( lua_State *L, int idx, img_spec_t *spec )
+{
+    int top = lua_gettop( L );
+    const char *name = NULL;
+    
+    if( top >= idx && lua_istable( L, top ) )
+    {
+        if( ( name = check_encode_opts( L, top, &spec->enc ) ) ){
+            luaL_argerror( L, top, lua_pushfstring( L, "invalid %s option", 
+                                                    name ) );
+        }
+        lua_settop( L, top - 1 );
+    }
+}
+
+
+// save the image to destination argument, or return the encoded image if 
+// encode is not 0.
+static int export_lua( lua_State *L, uint8_t mode, int encode )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    img_spec_t spec;
+    img_dest_t dest;
+    membuf_t buf;
+    int rc = 0;
+    
+    membuf_init( &buf );
+    img_spec_init( &spec, img, mode );
+    if( encode ){
+        dest = (img_dest_t){ NULL, -1, &buf };
+        check_export_opts( L, 2, &spec );
+        check_spec_args( L, 2, &spec );
+    }
+    else {
+        check_dest( L, 2, &dest );
+        check_export_opts( L, 3, &spec );
+        check_spec_args( L, 3, &spec );
+    }
+    
+    rc = img_export( img, &spec, &dest );
+    
+    // failed
+    if( rc != 0 ){
+        membuf_dispose( &buf );
+        if( encode ){
+            lua_pushnil( L );
+            lua_pushstring( L, strerror( errno ) );
+            return 2;
+        }
+        lua_pushstring( L, strerror( errno ) );
+    }
+    // success
+    else if( encode ){
+        lua_pushlstring( L, (const char*)buf.data, buf.len );
+        membuf_dispose( &buf );
+    }
+    else {
+        lua_pushnil( L );
+    }
+    
+    return 1;
+}
+
+
+static int save_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_STRETCH, 0 );
+}
+
+
+static int save_crop_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_CROP, 0 );
+}
+
+
+static int save_trim_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_TRIM, 0 );
+}
+
+
+static int save_aspect_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_ASPECT, 0 );
+}
+
+
+static int encode_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_STRETCH, 1 );
+}
+
+
+static int encode_crop_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_CROP, 1 );
+}
+
+
+static int encode_trim_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_TRIM, 1 );
+}
+
+
+static int encode_aspect_lua( lua_State *L )
+{
+    return export_lua( L, IMG_MODE_ASPECT, 1 );
+}
+
+
+// MARK: batch export
+
+static lua_Number batch_optnumber( lua_State *L, const char *where, const char *k, 
+                                   lua_Number def )
+{
+    lua_Number v = def;
+    
+    lua_getfield( L, -1, k );
+    if( !lua_isnil( L, -1 ) )
+    {
+        if( !lua_isnumber( L, -1 ) ){
+            luaL_error( L, "%s.%s must be number", where, k );
+        }
+        v = lua_tonumber( L, -1 );
+    }
+    lua_pop( L, 1 );
+    
+    return v;
+}
+
+
+static const char *batch_optstring( lua_State *L, const char *where, const char *k, 
+                                    const char *def )
+{
+    const char *v = def;
+    
+    lua_getfield( L, -1, k );
+    if( !lua_isnil( L, -1 ) )
+    {
+        if( lua_type( L, -1 ) != LUA_TSTRING ){
+            luaL_error( L, "%s.%s must be string", where, k );
+        }
+        v = lua_tostring( L, -1 );
+    }
+    // string value is still referenced by specs table
+    lua_pop( L, 1 );
+    
+    return v;
+}
+
+
+// the destination is not required if optdest is not 0
+static void batch_checkspec( lua_State *L, img_t *img, const char *where, 
+                             img_batch_t *item, int optdest )
+{
+    const char *mode = NULL;
+    const char *name = NULL;
+    lua_Number arg = 0;
+    int filter = 0;
+    
+    if( !lua_istable( L, -1 ) ){
+        luaL_error( L, "%s must be table", where );
+    }
+    
+    // destination path or fd
+    item->dest = (img_dest_t){ NULL, -1, NULL };
+    if( !( item->dest.path = batch_optstring( L, where, "path", NULL ) ) )
+    {
+        arg = batch_optnumber( L, where, "fd", -1 );
+        if( arg < -1 || arg > INT_MAX || ( arg == -1 && !optdest ) ){
+            luaL_error( L, "%s.path must be string", where );
+        }
+        item->dest.fd = (int)arg;
+    }
+    // export mode
+    mode = batch_optstring( L, where, "mode", "stretch" );
+    if( strcmp( mode, "stretch" ) == 0 ){
+        img_spec_init( &item->spec, img, IMG_MODE_STRETCH );
+    }
+    else if( strcmp( mode, "crop" ) == 0 ){
+        img_spec_init( &item->spec, img, IMG_MODE_CROP );
+    }
+    else if( strcmp( mode, "trim" ) == 0 ){
+        img_spec_init( &item->spec, img, IMG_MODE_TRIM );
+    }
+    else if( strcmp( mode, "aspect" ) == 0 ){
+        img_spec_init( &item->spec, img, IMG_MODE_ASPECT );
+    }
+    else {
+        luaL_error( L, "%s.mode must be stretch, crop, trim or aspect", 
+                    where );
+    }
+    
+    // size
+    arg = batch_optnumber( L, where, "w", item->spec.resize.w );
+    if( arg < 1 || arg > INT_MAX ){
+        luaL_error( L, "%s.w must be larger than 0", where );
+    }
+    item->spec.resize.w = (int)arg;
+    arg = batch_optnumber( L, where, "h", item->spec.resize.h );
+    if( arg < 1 || arg > INT_MAX ){
+        luaL_error( L, "%s.h must be larger than 0", where );
+    }
+    item->spec.resize.h = (int)arg;
+    // alignment
+    arg = batch_optnumber( L, where, "halign", item->spec.halign );
+    if( arg < IMG_ALIGN_LEFT || arg > IMG_ALIGN_RIGHT ){
+        luaL_error( L, "%s.halign must be LEFT, RIGHT or CENTER", where );
+    }
+    item->spec.halign = (uint8_t)arg;
+    arg = batch_optnumber( L, where, "valign", item->spec.valign );
+    if( arg < IMG_ALIGN_TOP || arg > IMG_ALIGN_BOTTOM ){
+        luaL_error( L, "%s.valign must be TOP, BOTTOM or MIDDLE", where );
+    }
+    item->spec.valign = (uint8_t)arg;
+    // background color
+    arg = batch_optnumber( L, where, "hue", item->spec.hue );
+    SETVAL_IN_RANGE( item->spec.hue, float, arg, 0, 360 );
+    arg = batch_optnumber( L, where, "saturation", item->spec.saturation );
+    SETVAL_IN_RANGE( item->spec.saturation, float, arg, 0, 1 );
+    arg = batch_optnumber( L, where, "lightness", item->spec.lightness );
+    SETVAL_IN_RANGE( item->spec.lightness, float, arg, 0, 1 );
+    arg = batch_optnumber( L, where, "alpha", item->spec.alpha );
+    SETVAL_IN_RANGE( item->spec.alpha, int, arg, 0, 255 );
+    
+    // resample filter
+    filter = resample_filter( batch_optstring( L, where, "filter", 
+                              resample_filter_name( img->filter ) ) );
+    if( filter == -1 ){
+        luaL_error( L, "%s.filter must be imlib, box, bilinear, "
+                    "bicubic or lanczos", where );
+    }
+    item->spec.filter = (uint8_t)filter;
+    
+    // export options
+    arg = batch_optnumber( L, where, "quality", img->quality );
+    SETVAL_IN_RANGE( item->quality, uint8_t, arg, 0, 100 );
+    item->format = batch_optstring( L, where, "format", img->format );
+    if( strlen( item->format ) >= MAX_FORMAT_LEN ){
+        luaL_error( L, "%s.format is too long", where );
+    }
+    else if( ( name = check_encode_opts( L, lua_gettop( L ), 
+                                         &item->spec.enc ) ) ){
+        luaL_error( L, "%s.%s is invalid", where, name );
+    }
+}
+
+
+static int save_batch_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    int nspec = 0;
+    int nerr = 0;
+    int i = 0;
+    img_batch_t *items = NULL;
+    char where[32];
+    
+    luaL_checktype( L, 2, LUA_TTABLE );
+    nspec = (int)lstate_rawlen( L, 2 );
+    lua_settop( L, 2 );
+    
+    // check all specs before export
+    items = (img_batch_t*)lua_newuserdata( L, sizeof( img_batch_t ) * 
+                                              (size_t)( nspec + 1 ) );
+    for( i = 0; i < nspec; i++ ){
+        snprintf( where, sizeof( where ), "specs[%d]", i + 1 );
+        lua_rawgeti( L, 2, i + 1 );
+        batch_checkspec( L, img, where, &items[i], 0 );
+        lua_pop( L, 1 );
+    }
+    
+    img_export_batch( img, items, nspec );
+    for( i = 0; i < nspec; i++ )
+    {
+        if( items[i].errnum )
+        {
+            // create error table
+            if( !nerr++ ){
+                lua_newtable( L );
+            }
+            lua_pushstring( L, strerror( items[i].errnum ) );
+            lua_rawseti( L, -2, i + 1 );
+        }
+    }
+    
+    // success
+    if( !nerr ){
+        lua_pushnil( L );
+    }
+    
+    return 1;
+}
+
+
+// MARK: atlas
+// returns the image at the top of the stack, or NULL
+static img_t *atlas_toimg( lua_State *L )
+{
+    img_t *img = (img_t*)lua_touserdata( L, -1 );
+    int ok = 0;
+    
+    if( img && lua_getmetatable( L, -1 ) ){
+        luaL_getmetatable( L, MODULE_MT );
+        ok = lua_rawequal( L, -1, -2 );
+        lua_pop( L, 2 );
+    }
+    
+    return ok && img->blob && !img->release ? img : NULL;
+}
 
 
+static int atlas_lua( lua_State *L )
+{
+    int nitem = 0;
+    int columns = 1;
+    int encode = 0;
+    int i = 0;
+    lua_Number arg = 0;
+    img_atlas_item_t *items = NULL;
+    img_batch_t b;
+    img_t tmpl;
+    membuf_t buf;
+    
+    luaL_checktype( L, 1, LUA_TTABLE );
+    luaL_checktype( L, 2, LUA_TTABLE );
+    lua_settop( L, 2 );
+    nitem = (int)lstate_rawlen( L, 1 );
+    luaL_argcheck( L, nitem > 0, 1, "images must not be empty" );
+    
+    items = (img_atlas_item_t*)lua_newuserdata( L, sizeof( img_atlas_item_t ) * 
+                                                   (size_t)nitem );
+    for(; i < nitem; i++ )
+    {
+        lua_rawgeti( L, 1, i + 1 );
+        if( !( items[i].img = atlas_toimg( L ) ) ){
+            luaL_error( L, "images[%d] must be image", i + 1 );
+        }
+        lua_pop( L, 1 );
+    }
+    
+    // spec of the cells and the destination of the atlas
+    img_init( &tmpl, NULL, 0, 0 );
+    img_format_copy( &tmpl, DEFAULT_FORMAT, sizeof( DEFAULT_FORMAT ) );
+    lua_pushvalue( L, 2 );
+    batch_checkspec( L, &tmpl, "opts", &b, 1 );
+    // square by default
+    while( columns * columns < nitem ){
+        columns++;
+    }
+    arg = batch_optnumber( L, "opts", "columns", columns );
+    if( arg < 1 || arg > INT_MAX ){
+        luaL_error( L, "opts.columns must be larger than 0" );
+    }
+    columns = (int)arg;
+    
+    // encode into memory if the destination is not specified
+    if( !b.dest.path && b.dest.fd == -1 ){
+        encode = 1;
+        membuf_init( &buf );
+        b.dest.buf = &buf;
+    }
+    
+    if( img_atlas( items, nitem, columns, &b ) != 0 ){
+        if( encode ){
+            membuf_dispose( &buf );
+        }
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( errno ) );
+        return 2;
+    }
+    else if( encode ){
+        lua_pushlstring( L, (const char*)buf.data, buf.len );
+        membuf_dispose( &buf );
+    }
+    else {
+        lua_pushboolean( L, 1 );
+    }
+    
+    // bounds of the images
+    lua_createtable( L, nitem, 0 );
+    for( i = 0; i < nitem; i++ ){
+        lua_createtable( L, 0, 4 );
+        lstate_num2tbl( L, "x", items[i].bounds.x );
+        lstate_num2tbl( L, "y", items[i].bounds.y );
+        lstate_num2tbl( L, "w", items[i].bounds.w );
+        lstate_num2tbl( L, "h", items[i].bounds.h );
+        lua_rawseti( L, -2, i + 1 );
+    }
+    
+    return 2;
+}
+
+
+// MARK: thread pool
 typedef struct {
-    void *blob;
-    size_t bytes;
-    img_size_t size;
-    img_size_t resize;
+    pool_job_t job;
+    int id;
+    // reference of the image object
+    int ref;
+    img_t *img;
+    img_spec_t spec;
+    img_dest_t dest;
+    membuf_t buf;
     uint8_t quality;
     char format[MAX_FORMAT_LEN];
-} img_t;
-
-
-#define SETVAL_IN_RANGE(x,t,val,min,max) do { \
-    if( val < min ){ \
-        (x) = (t)min; \
-    } \
-    else if( val > max ){ \
-        (x) = (t)max; \
-    } \
-    else { \
-        (x) = (t)val; \
-    } \
-}while(0)
+    int errnum;
+    int ran;
+    char path[];
+} img_job_t;
 
 
-#define BOUNDS_ALIGN(bounds,align,size) do{ \
-    switch( align ){ \
-        case IMG_ALIGN_CENTER: \
-            bounds.x = ( size.w - bounds.w ) / 2; \
-        break; \
-        case IMG_ALIGN_RIGHT: \
-            bounds.x = size.w - bounds.w; \
-        break; \
-        case IMG_ALIGN_MIDDLE: \
-            bounds.y = ( size.h - bounds.h ) / 2; \
-        break; \
-        case IMG_ALIGN_BOTTOM: \
-            bounds.y = size.h - bounds.h; \
-        break; \
-    } \
-}while(0)
+typedef struct {
+    pool_t *pool;
+    int nextid;
+} img_pool_t;
 
 
-static inline void liberr2errno( ImlibLoadError err )
-{
-    switch( err )
-    {
-        case IMLIB_LOAD_ERROR_FILE_DOES_NOT_EXIST:
-        case IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT:
-        case IMLIB_LOAD_ERROR_PATH_COMPONENT_NOT_DIRECTORY:
-        case IMLIB_LOAD_ERROR_PATH_POINTS_OUTSIDE_ADDRESS_SPACE:
-            errno = ENOENT;
-        break;
-        case IMLIB_LOAD_ERROR_PATH_TOO_LONG:
-            errno = ENAMETOOLONG;
-        break;
-        case IMLIB_LOAD_ERROR_FILE_IS_DIRECTORY:
-            errno = EISDIR;
-        break;
-        case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_READ:
-        case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_WRITE:
-            errno = EACCES;
-        break;
-        case IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT:
-            errno = EINVAL;
-        break;
-        case IMLIB_LOAD_ERROR_TOO_MANY_SYMBOLIC_LINKS:
-            errno = EMLINK;
-        break;
-        case IMLIB_LOAD_ERROR_OUT_OF_MEMORY:
-            errno = ENOMEM;
-        break;
-        case IMLIB_LOAD_ERROR_OUT_OF_FILE_DESCRIPTORS:
-            errno = EMFILE;
-        break;
-        case IMLIB_LOAD_ERROR_OUT_OF_DISK_SPACE:
-            errno = ENOSPC;
-        break;
-        case IMLIB_LOAD_ERROR_NONE:
-        case IMLIB_LOAD_ERROR_UNKNOWN:
-        break;
-        //default:
+static const struct {
+    const char *name;
+    uint8_t mode;
+    int encode;
+} POOL_OPS[] = {
+    { "save", IMG_MODE_STRETCH, 0 },
+    { "saveCrop", IMG_MODE_CROP, 0 },
+    { "saveTrim", IMG_MODE_TRIM, 0 },
+    { "saveAspect", IMG_MODE_ASPECT, 0 },
+    { "encode", IMG_MODE_STRETCH, 1 },
+    { "encodeCrop", IMG_MODE_CROP, 1 },
+    { "encodeTrim", IMG_MODE_TRIM, 1 },
+    { "encodeAspect", IMG_MODE_ASPECT, 1 },
+    { NULL, 0, 0 }
+};
+
+
+// lua_close() finalizes the image objects regardless of the references 
+// from the jobs, so the finalizer waits until the jobs are no longer running.
+static pthread_mutex_t JOB_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t JOB_COND = PTHREAD_COND_INITIALIZER;
+
+
+static void job_done( img_job_t *j )
+{
+    pthread_mutex_lock( &JOB_MUTEX );
+    j->img->nrun--;
+    j->ran = 1;
+    pthread_cond_broadcast( &JOB_COND );
+    pthread_mutex_unlock( &JOB_MUTEX );
+}
+
+
+static void job_wait( img_t *img )
+{
+    pthread_mutex_lock( &JOB_MUTEX );
+    while( img->nrun > 0 ){
+        pthread_cond_wait( &JOB_COND, &JOB_MUTEX );
+    }
+    pthread_mutex_unlock( &JOB_MUTEX );
+}
+
+
+// called on the worker thread
+static void job_run( pool_job_t *job )
+{
+    img_job_t *j = (img_job_t*)job;
+    Imlib_Image src = img_wrap( j->img );
+    
+    if( save_spec( j->img, src, &j->spec, &j->dest, j->quality, 
+                   j->format ) != 0 ){
+        j->errnum = errno;
+    }
+    img_unwrap( j->img, src );
+    job_done( j );
+}
+
+
+static void job_release( lua_State *L, img_job_t *j )
+{
+    // job was discarded by closing the pool
+    if( !j->ran ){
+        job_done( j );
+    }
+    luaL_unref( L, LUA_REGISTRYINDEX, j->ref );
+    // dispose the image that was freed while the jobs were running
+    if( --j->img->njob == 0 && j->img->release ){
+        img_dispose( j->img );
+    }
+    membuf_dispose( &j->buf );
+    free( j );
+}
+
+
+static inline img_pool_t *check_pool( lua_State *L )
+{
+    img_pool_t *p = (img_pool_t*)luaL_checkudata( L, 1, POOL_MT );
+    
+    if( !p->pool ){
+        luaL_argerror( L, 1, "pool is already closed" );
+    }
+    
+    return p;
+}
+
+
+static int pool_submit_lua( lua_State *L )
+{
+    img_pool_t *p = check_pool( L );
+    img_t *img = (img_t*)luaL_checkudata( L, 2, MODULE_MT );
+    const char *op = luaL_checkstring( L, 3 );
+    int nargs = 0;
+    int i = 0;
+    int n = 0;
+    img_spec_t spec;
+    img_dest_t dest;
+    size_t len = 0;
+    img_job_t *job = NULL;
+    
+    while( POOL_OPS[i].name && strcmp( POOL_OPS[i].name, op ) != 0 ){
+        i++;
+    }
+    if( !POOL_OPS[i].name ){
+        return luaL_argerror( L, 3, "unknown operation" );
+    }
+    else if( !img->blob || img->release ){
+        return luaL_argerror( L, 2, "image is already freed" );
+    }
+    // unpack arguments of operation
+    else if( !lua_isnoneornil( L, 4 ) ){
+        luaL_checktype( L, 4, LUA_TTABLE );
+        nargs = (int)lstate_rawlen( L, 4 );
+    }
+    lua_settop( L, 4 );
+    luaL_checkstack( L, nargs, "too many arguments" );
+    for( n = 1; n <= nargs; n++ ){
+        lua_rawgeti( L, 4, n );
+    }
+    
+    img_spec_init( &spec, img, POOL_OPS[i].mode );
+    if( POOL_OPS[i].encode ){
+        dest = (img_dest_t){ NULL, -1, NULL };
+        check_export_opts( L, 5, &spec );
+        check_spec_args( L, 5, &spec );
+    }
+    else {
+        check_dest( L, 5, &dest );
+        check_export_opts( L, 6, &spec );
+        check_spec_args( L, 6, &spec );
+        if( dest.path ){
+            len = strlen( dest.path ) + 1;
+        }
+    }
+    
+    if( !( job = malloc( sizeof( img_job_t ) + len ) ) ){
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( errno ) );
+        return 2;
+    }
+    job->job.run = job_run;
+    job->img = img;
+    job->spec = spec;
+    job->dest = dest;
+    membuf_init( &job->buf );
+    if( POOL_OPS[i].encode ){
+        job->dest.buf = &job->buf;
+    }
+    else if( dest.path ){
+        memcpy( job->path, dest.path, len );
+        job->dest.path = job->path;
+    }
+    // snapshot current export options
+    job->quality = img->quality;
+    memcpy( job->format, img->format, MAX_FORMAT_LEN );
+    job->errnum = 0;
+    job->ran = 0;
+    job->id = ++p->nextid;
+    // retain the image until the job is collected
+    lua_pushvalue( L, 2 );
+    job->ref = luaL_ref( L, LUA_REGISTRYINDEX );
+    img->njob++;
+    pthread_mutex_lock( &JOB_MUTEX );
+    img->nrun++;
+    pthread_mutex_unlock( &JOB_MUTEX );
+    pool_submit( p->pool, &job->job );
+    
+    lua_pushinteger( L, job->id );
+    
+    return 1;
+}
+
+
+static int pool_fd_lua( lua_State *L )
+{
+    img_pool_t *p = check_pool( L );
+    
+    lua_pushinteger( L, pool_fd( p->pool ) );
+    
+    return 1;
+}
+
+
+static int pool_collect_lua( lua_State *L )
+{
+    img_pool_t *p = check_pool( L );
+    pool_job_t *job = pool_collect( p->pool );
+    img_job_t *j = NULL;
+    int i = 0;
+    
+    lua_newtable( L );
+    while( job )
+    {
+        j = (img_job_t*)job;
+        job = job->next;
+        lua_createtable( L, 0, 2 );
+        lstate_num2tbl( L, "id", j->id );
+        if( j->errnum ){
+            lstate_str2tbl( L, "err", strerror( j->errnum ) );
+        }
+        else if( j->dest.buf ){
+            lua_pushstring( L, "data" );
+            lua_pushlstring( L, (const char*)j->buf.data, j->buf.len );
+            lua_rawset( L, -3 );
+        }
+        lua_rawseti( L, -2, ++i );
+        job_release( L, j );
+    }
+    
+    return 1;
+}
+
+
+static int pool_gc( lua_State *L )
+{
+    img_pool_t *p = (img_pool_t*)luaL_checkudata( L, 1, POOL_MT );
+    pool_job_t *job = NULL;
+    img_job_t *j = NULL;
+    
+    if( p->pool )
+    {
+        job = pool_free( p->pool );
+        p->pool = NULL;
+        while( job ){
+            j = (img_job_t*)job;
+            job = job->next;
+            job_release( L, j );
+        }
+    }
+    
+    return 0;
+}
+
+
+static int pool_tostring_lua( lua_State *L )
+{
+    lua_pushfstring( L, POOL_MT ": %p", lua_touserdata( L, 1 ) );
+    return 1;
+}
+
+
+static int pool_lua( lua_State *L )
+{
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    int nthreads = luaL_optint( L, 1, ncpu > 0 ? (int)ncpu : 1 );
+    img_pool_t *p = NULL;
+    
+    if( nthreads < 1 ){
+        return luaL_argerror( L, 1, "nthreads must be larger than 0" );
+    }
+    
+    p = (img_pool_t*)lua_newuserdata( L, sizeof( img_pool_t ) );
+    if( ( p->pool = pool_new( nthreads ) ) ){
+        p->nextid = 0;
+        luaL_getmetatable( L, POOL_MT );
+        lua_setmetatable( L, -2 );
+        return 1;
+    }
+    
+    // got error
+    lua_pushnil( L );
+    lua_pushstring( L, strerror( errno ) );
+    
+    return 2;
+}
+
+
+static int raw_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    if( img->blob ){
+        lua_pushlightuserdata( L, img->blob );
+        lua_pushinteger( L, (lua_Integer)img->bytes );
+        return 2;
+    }
+    
+    lua_pushnil( L );
+    
+    return 1;
+}
+
+
+static int rawsize_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    lua_pushinteger( L, img->size.w );
+    lua_pushinteger( L, img->size.h );
+    
+    return 2;
+}
+
+
+static int origsize_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    lua_pushinteger( L, img->orig.w );
+    lua_pushinteger( L, img->orig.h );
+    
+    return 2;
+}
+
+
+static void push_hash( lua_State *L, const char *k, uint64_t hash )
+{
+    char hex[17];
+    
+    snprintf( hex, sizeof( hex ), "%016llx", (unsigned long long)hash );
+    lstate_str2tbl( L, k, hex );
+}
+
+
+static int fingerprint_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    int flags = FINGERPRINT_ALL;
+    fingerprint_t fp;
+    
+    // names of the fingerprints
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        size_t len = 0;
+        size_t i = 1;
+        int flag = 0;
+        
+        luaL_checktype( L, 2, LUA_TTABLE );
+        len = lstate_rawlen( L, 2 );
+        flags = 0;
+        for(; i <= len; i++ )
+        {
+            lua_rawgeti( L, 2, (int)i );
+            if( lua_type( L, -1 ) != LUA_TSTRING || 
+                !( flag = fingerprint_flag( lua_tostring( L, -1 ) ) ) ){
+                return luaL_argerror( L, 2, 
+                    "names must be dhash, phash, avgcolor or opaque" );
+            }
+            flags |= flag;
+            lua_pop( L, 1 );
+        }
+    }
+    
+    if( !img->blob ){
+        errno = EBADF;
+    }
+    else if( fingerprint( &fp, (const uint32_t*)img->blob, img->size.w, 
+                          img->size.h, flags ) == 0 )
+    {
+        lua_createtable( L, 0, 4 );
+        if( flags & FINGERPRINT_DHASH ){
+            push_hash( L, "dhash", fp.dhash );
+        }
+        if( flags & FINGERPRINT_PHASH ){
+            push_hash( L, "phash", fp.phash );
+        }
+        if( flags & FINGERPRINT_AVGCOLOR ){
+            lstate_num2tbl( L, "avgcolor", fp.avgcolor );
+        }
+        if( flags & FINGERPRINT_OPAQUE ){
+            lua_pushstring( L, "opaque" );
+            lua_pushboolean( L, fp.opaque );
+            lua_rawset( L, -3 );
+        }
+        return 1;
+    }
+    
+    lua_pushnil( L );
+    lua_pushstring( L, strerror( errno ) );
+    
+    return 2;
+}
+
+
+static int size_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        int width = luaL_checkint( L, 2 );
+        int height = luaL_checkint( L, 3 );
+        
+        if( width < 0 ){
+            luaL_argerror( L, 2, "width must be larger than 0" );
+        }
+        else if( height < 0 ){
+            luaL_argerror( L, 3, "height must be larger than 0" );
+        }
+        
+        img->resize.w = width;
+        img->resize.h = height;
+    }
+    
+    lua_pushinteger( L, img->resize.w );
+    lua_pushinteger( L, img->resize.h );
+    
+    return 2;
+}
+
+
+static int quality_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    if( !lua_isnoneornil( L, 2 ) ){
+        int quality = luaL_checkint( L, 2 );
+        SETVAL_IN_RANGE( img->quality, uint8_t, quality, 0, 100 );
+    }
+    
+    lua_pushinteger( L, img->quality );
+    
+    return 1;
+}
+
+
+static int filter_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        const char *name = luaL_checkstring( L, 2 );
+        int filter = resample_filter( name );
+        
+        if( filter == -1 ){
+            return luaL_argerror( L, 2, 
+                "filter must be imlib, box, bilinear, bicubic or lanczos" );
+        }
+        img->filter = (uint8_t)filter;
+    }
+    
+    lua_pushstring( L, resample_filter_name( img->filter ) );
+    
+    return 1;
+}
+
+
+static int format_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        size_t len = 0;
+        const char *format = luaL_checklstring( L, 2, &len );
+        
+        // allocation error
+        if( img_format_copy( img, format, len ) == -1 ){
+            lua_pushnil( L );
+            lua_pushstring( L, strerror( errno ) );
+            return 2;
+        }
+    }
+    
+    lua_pushinteger( L, img->quality );
+    
+    return 1;
+}
+
+
+static int free_lua( lua_State *L )
+{
+    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    
+    // dispose after the pool jobs are collected
+    if( img->njob ){
+        img->release = 1;
+    }
+    else
+    {
+        // release the reference of the borrowed data
+        if( img->borrowed ){
+            lua_newtable( L );
+            lstate_setuservalue( L, 1 );
+        }
+        img_dispose( img );
+    }
+    
+    return 0;
+}
+
+
+static int dealloc_gc( lua_State *L )
+{
+    img_t *img = (img_t*)lua_touserdata( L, 1 );
+    
+    job_wait( img );
+    img_dispose( img );
+    
+    return 0;
+}
+
+
+static int tostring_lua( lua_State *L )
+{
+    lua_pushfstring( L, MODULE_MT ": %p", lua_touserdata( L, 1 ) );
+    return 1;
+}
+
+
+static int cache_lua( lua_State *L )
+{
+    cache_stats_t stats;
+    int reset = 0;
+    
+    // update capacity
+    if( !lua_isnoneornil( L, 1 ) )
+    {
+        luaL_checktype( L, 1, LUA_TTABLE );
+        lua_getfield( L, 1, "bytes" );
+        if( !lua_isnil( L, -1 ) ){
+            lua_Number n = luaL_checknumber( L, -1 );
+            
+            luaL_argcheck( L, n >= 0, 1, "bytes must be larger than -1" );
+            if( img_cache_resize( (size_t)n ) != 0 ){
+                lua_pushnil( L );
+                lua_pushstring( L, strerror( errno ) );
+                return 2;
+            }
+        }
+        lua_getfield( L, 1, "reset" );
+        reset = lua_toboolean( L, -1 );
+        lua_pop( L, 2 );
+    }
+    
+    if( img_cache_stats( &stats, reset ) != 0 ){
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( errno ) );
+        return 2;
+    }
+    lua_createtable( L, 0, 6 );
+    lstate_num2tbl( L, "capacity", stats.capacity );
+    lstate_num2tbl( L, "bytes", stats.bytes );
+    lstate_num2tbl( L, "entries", stats.entries );
+    lstate_num2tbl( L, "hits", stats.hits );
+    lstate_num2tbl( L, "misses", stats.misses );
+    lstate_num2tbl( L, "evictions", stats.evictions );
+    
+    return 1;
+}
+
+
+static int output_cache_lua( lua_State *L )
+{
+    outcache_stats_t stats;
+    int reset = 0;
+    
+    // update the output cache
+    if( !lua_isnoneornil( L, 1 ) )
+    {
+        const char *dir = NULL;
+        lua_Number bytes = 0;
+        int link = 0;
+        
+        luaL_checktype( L, 1, LUA_TTABLE );
+        outcache_stats( &stats, 0 );
+        free( stats.dir );
+        bytes = (lua_Number)stats.index.capacity;
+        link = stats.link;
+        
+        lua_getfield( L, 1, "dir" );
+        if( !lua_isnil( L, -1 ) ){
+            dir = luaL_checkstring( L, -1 );
+        }
+        lua_getfield( L, 1, "bytes" );
+        if( !lua_isnil( L, -1 ) ){
+            bytes = luaL_checknumber( L, -1 );
+            luaL_argcheck( L, bytes >= 0, 1, "bytes must be larger than -1" );
+        }
+        lua_getfield( L, 1, "link" );
+        if( !lua_isnil( L, -1 ) ){
+            link = lua_toboolean( L, -1 );
+        }
+        lua_getfield( L, 1, "reset" );
+        reset = lua_toboolean( L, -1 );
+        
+        if( outcache_config( dir, (size_t)bytes, link ) != 0 ){
+            lua_pushnil( L );
+            lua_pushstring( L, strerror( errno ) );
+            return 2;
+        }
+        lua_pop( L, 4 );
+    }
+    
+    outcache_stats( &stats, reset );
+    lua_createtable( L, 0, 8 );
+    if( stats.dir ){
+        lstate_str2tbl( L, "dir", stats.dir );
+        free( stats.dir );
+    }
+    lua_pushstring( L, "link" );
+    lua_pushboolean( L, stats.link );
+    lua_rawset( L, -3 );
+    lstate_num2tbl( L, "capacity", stats.index.capacity );
+    lstate_num2tbl( L, "bytes", stats.index.bytes );
+    lstate_num2tbl( L, "entries", stats.index.entries );
+    lstate_num2tbl( L, "hits", stats.index.hits );
+    lstate_num2tbl( L, "misses", stats.index.misses );
+    lstate_num2tbl( L, "evictions", stats.index.evictions );
+    
+    return 1;
+}
+
+
+
+// check options table of load functions
+static void check_load_opts( lua_State *L, int idx, codec_hint_t *hint )
+{
+    *hint = (codec_hint_t){ 0, 0, 0, 0, 0 };
+    if( !lua_isnoneornil( L, idx ) )
+    {
+        luaL_checktype( L, idx, LUA_TTABLE );
+        // hint size of decoding
+        lua_getfield( L, idx, "hint_w" );
+        if( !lua_isnil( L, -1 ) && 
+            ( !lua_isnumber( L, -1 ) || 
+              ( hint->w = (int)lua_tointeger( L, -1 ) ) < 0 ) ){
+            luaL_argerror( L, idx, "hint_w must be larger than or equal to 0" );
+        }
+        lua_getfield( L, idx, "hint_h" );
+        if( !lua_isnil( L, -1 ) && 
+            ( !lua_isnumber( L, -1 ) || 
+              ( hint->h = (int)lua_tointeger( L, -1 ) ) < 0 ) ){
+            luaL_argerror( L, idx, "hint_h must be larger than or equal to 0" );
+        }
+        // reduce to the hint size while decoding
+        lua_getfield( L, idx, "stream" );
+        hint->stream = lua_toboolean( L, -1 );
+        // EXIF
+        lua_getfield( L, idx, "orient" );
+        hint->orient = lua_toboolean( L, -1 );
+        lua_getfield( L, idx, "exif_thumbnail" );
+        hint->thumbnail = lua_toboolean( L, -1 );
+        lua_pop( L, 5 );
+    }
+}
+
+
+static int load_lua( lua_State *L )
+{
+    const char *path = luaL_checkstring( L, 1 );
+    codec_hint_t hint;
+    img_t *img = NULL;
+    uint64_t start = stats_now();
+    struct stat st;
+    size_t bytes = 0;
+    char key[CACHE_KEY_LEN];
+    int keyed = 0;
+    int rc = -1;
+    
+    check_load_opts( L, 2, &hint );
+    img = (img_t*)lua_newuserdata( L, sizeof( img_t ) );
+    if( img && stat( path, &st ) == 0 ){
+        bytes = (size_t)st.st_size;
+        keyed = ( img_cache_enabled() || outcache_enabled() ) && 
+                img_cache_key_path( key, path, &st, &hint ) == 0;
+    }
+    if( keyed && img_cache_enabled() && img_cache_get( img, key ) == 0 ){
+        rc = 0;
+    }
+    else if( img && ( rc = img_load( img, path, &hint ) ) == 0 ){
+        stats_stage( STATS_DECODE, start );
+        if( keyed && img_cache_enabled() ){
+            img_cache_put( img, key );
+        }
+    }
+    
+    if( rc == 0 ){
+        if( keyed ){
+            img_digest( img, key, strlen( key ) );
+        }
+        stats_op( STATS_LOAD, img->format, start, bytes, img->bytes, 0 );
+        // set metatable
+        luaL_getmetatable( L, MODULE_MT );
+        lua_setmetatable( L, -2 );
+        return 1;
+    }
+    
+    // got error
+    stats_op( STATS_LOAD, NULL, start, 0, 0, errno );
+    lua_pushnil( L );
+    lua_pushstring( L, strerror( errno ) );
+    
+    return 2;
+}
+
+
+static int load_buffer_lua( lua_State *L )
+{
+    size_t len = 0;
+    const char *data = luaL_checklstring( L, 1, &len );
+    const char *format = luaL_optstring( L, 2, NULL );
+    codec_hint_t hint;
+    img_t *img = NULL;
+    uint64_t start = stats_now();
+    char key[CACHE_KEY_LEN];
+    int keyed = 0;
+    int rc = -1;
+    
+    check_load_opts( L, 3, &hint );
+    img = (img_t*)lua_newuserdata( L, sizeof( img_t ) );
+    keyed = img && ( img_cache_enabled() || outcache_enabled() ) && 
+            img_cache_key_buffer( key, data, len, format, &hint ) == 0;
+    if( keyed && img_cache_enabled() && img_cache_get( img, key ) == 0 ){
+        rc = 0;
+    }
+    else if( img && ( rc = img_load_buffer( img, data, len, format, 
+                                            &hint ) ) == 0 ){
+        stats_stage( STATS_DECODE, start );
+        if( keyed && img_cache_enabled() ){
+            img_cache_put( img, key );
+        }
+    }
+    
+    if( rc == 0 ){
+        if( keyed ){
+            img_digest( img, key, strlen( key ) );
+        }
+        stats_op( STATS_LOAD_BUFFER, img->format, start, len, img->bytes, 0 );
+        // set metatable
+        luaL_getmetatable( L, MODULE_MT );
+        lua_setmetatable( L, -2 );
+        return 1;
+    }
+    
+    // got error
+    stats_op( STATS_LOAD_BUFFER, format, start, len, 0, errno );
+    lua_pushnil( L );
+    lua_pushstring( L, strerror( errno ) );
+    
+    return 2;
+}
+
+
+typedef struct {
+    int fmt;
+    size_t stride;
+    // known length of the data, or 0
+    size_t len;
+    int borrow;
+} img_raw_t;
+
+
+static void check_read_opts( lua_State *L, int idx, int w, img_raw_t *raw )
+{
+    if( !lua_isnoneornil( L, idx ) )
+    {
+        luaL_checktype( L, idx, LUA_TTABLE );
+        lua_getfield( L, idx, "format" );
+        if( !lua_isnil( L, -1 ) && 
+            ( raw->fmt = codec_raw_format( luaL_checkstring( L, -1 ) ) ) < 0 ){
+            luaL_argerror( L, idx, "unknown pixel format" );
+        }
+        lua_getfield( L, idx, "stride" );
+        if( !lua_isnil( L, -1 ) ){
+            lua_Number n = luaL_checknumber( L, -1 );
+            
+            if( n < (lua_Number)w * codec_raw_bpp( raw->fmt ) ){
+                luaL_argerror( L, idx, "stride must be larger than or equal to the row length" );
+            }
+            raw->stride = (size_t)n;
+        }
+        // length of the lightuserdata
+        lua_getfield( L, idx, "length" );
+        if( !lua_isnil( L, -1 ) && !raw->len ){
+            raw->len = (size_t)luaL_checknumber( L, -1 );
+        }
+        lua_getfield( L, idx, "borrow" );
+        raw->borrow = lua_toboolean( L, -1 );
+        lua_pop( L, 4 );
+    }
+    if( !raw->stride ){
+        raw->stride = (size_t)w * (size_t)codec_raw_bpp( raw->fmt );
+    }
+}
+
+
+// keep the data and the owner value alive while the image refers to them
+static void img_borrow( lua_State *L, int data, int opts )
+{
+    lua_createtable( L, 2, 0 );
+    lua_pushvalue( L, data );
+    lua_rawseti( L, -2, 1 );
+    if( lua_istable( L, opts ) ){
+        lua_getfield( L, opts, "owner" );
+        lua_rawseti( L, -2, 2 );
+    }
+    lstate_setuservalue( L, -2 );
+}
+
+
+static int read_lua( lua_State *L )
+{
+    int w = luaL_checkint( L, 1 );
+    int h = luaL_checkint( L, 2 );
+    const void *ptr = NULL;
+    img_raw_t raw = { CODEC_RAW_ARGB32, 0, 0, 0 };
+    img_t *img = NULL;
+    uint64_t start = 0;
+    
+    // check arguments
+    if( w < 1 ){
+        return luaL_argerror( L, 1, "width must be larger than 0" );
+    }
+    else if( h < 1 ){
+        return luaL_argerror( L, 2, "height must be larger than 0" );
+    }
+    else if( lua_type( L, 3 ) == LUA_TSTRING ){
+        ptr = lua_tolstring( L, 3, &raw.len );
+    }
+    else if( lua_islightuserdata( L, 3 ) ){
+        if( !( ptr = lua_topointer( L, 3 ) ) ){
+            return luaL_argerror( L, 3, "data must not be NULL" );
+        }
+    }
+    else {
+        return luaL_argerror( L, 3, "data must be type of string or lightuserdata" );
+    }
+    check_read_opts( L, 4, w, &raw );
+    if( raw.len && raw.len < raw.stride * (size_t)( h - 1 ) + 
+                              (size_t)w * (size_t)codec_raw_bpp( raw.fmt ) ){
+        return luaL_argerror( L, 3, "data is shorter than the image" );
     }
-}
-
-
-static inline int img_format_copy( img_t *img, const char *format, size_t len )
-{
-    if( len < MAX_FORMAT_LEN ){
-        memcpy( img->format, format, len );
-        img->format[len] = 0;
-        return 0;
+    else if( raw.borrow && ( !codec_raw_is_native( raw.fmt ) || 
+                             raw.stride != sizeof( DATA32 ) * (size_t)w || 
+                             (uintptr_t)ptr % sizeof( DATA32 ) ) ){
+        return luaL_argerror( L, 4, "borrowed data must be aligned argb32 pixels without row padding" );
     }
+    start = stats_now();
     
-    return -1;
+    if( ( img = (img_t*)lua_newuserdata( L, sizeof( img_t ) ) ) && 
+        ( raw.borrow ? img_read_borrowed( img, w, h, (void*)ptr ) : 
+                       img_read( img, w, h, ptr, raw.stride, raw.fmt ) ) == 0 )
+    {
+        if( raw.borrow ){
+            img_borrow( L, 3, 4 );
+        }
+        stats_op( STATS_READ, img->format, start, img->bytes, img->bytes, 0 );
+        // set metatable
+        luaL_getmetatable( L, MODULE_MT );
+        lua_setmetatable( L, -2 );
+        return 1;
+    }
+    
+    // got error
+    stats_op( STATS_READ, DEFAULT_FORMAT, start, 0, 0, errno );
+    lua_pushnil( L );
+    lua_pushstring( L, strerror( errno ) );
+    
+    return 2;
 }
 
 
-static int img_load( img_t *img, const char *path )
+static int buffer_pool_lua( lua_State *L )
 {
-    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
-    Imlib_Image imimg = imlib_load_image_with_error_return( path, &err );
+    bufpool_stats_t stats;
+    int reset = 0;
     
-    if( img )
+    // update capacity
+    if( !lua_isnoneornil( L, 1 ) )
     {
-        imlib_context_set_image( imimg );
-        img->size.w =  imlib_image_get_width();
-        img->size.h = imlib_image_get_height();
-        // allocate buffer
-        img->bytes = sizeof( DATA32 ) * (size_t)img->size.w * (size_t)img->size.h;
-        img->blob = malloc( img->bytes );
-        if( img->blob )
-        {
-            char *format = imlib_image_format();
+        luaL_checktype( L, 1, LUA_TTABLE );
+        lua_getfield( L, 1, "bytes" );
+        if( !lua_isnil( L, -1 ) ){
+            lua_Number n = luaL_checknumber( L, -1 );
             
-            if( img_format_copy( img, format, strlen( format ) ) == 0 ){
-                memcpy( img->blob, imlib_image_get_data_for_reading_only(), 
-                        img->bytes );
-                imlib_free_image_and_decache();
-                
-                img->quality = 100;
-                img->resize = (img_size_t){ 0, 0 };
-                return 0;
-            }
-            // failed to copy
-            free( img->blob );
+            luaL_argcheck( L, n >= 0, 1, "bytes must be larger than -1" );
+            bufpool_resize( (size_t)n );
         }
-        
-        imlib_free_image_and_decache();
-    }
-    else {
-        liberr2errno( err );
+        lua_getfield( L, 1, "reset" );
+        reset = lua_toboolean( L, -1 );
+        lua_pop( L, 2 );
     }
     
-    return -1;
+    bufpool_stats( &stats, reset );
+    lua_createtable( L, 0, 6 );
+    lstate_num2tbl( L, "capacity", stats.capacity );
+    lstate_num2tbl( L, "bytes", stats.bytes );
+    lstate_num2tbl( L, "used", stats.used );
+    lstate_num2tbl( L, "peak", stats.peak );
+    lstate_num2tbl( L, "hits", stats.hits );
+    lstate_num2tbl( L, "misses", stats.misses );
+    
+    return 1;
 }
 
 
-static inline void save2path( img_t *img, const char *path, ImlibLoadError *err )
-{
-    // set quality
-    imlib_image_attach_data_value( "quality", NULL, img->quality, NULL );
-    imlib_image_set_format( img->format );
-    imlib_save_image_with_error_return( path, err );
-    imlib_free_image_and_decache();
-}
-
 
-static int save_lua( lua_State *L )
+// MARK: pipeline
+// check the manifest at index 1 into the items
+static void run_checkitems( lua_State *L, img_run_t *r, img_run_spec_t *specs )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    const char *path = luaL_checkstring( L, 2 );
-    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
-    Imlib_Image work = imlib_create_image_using_data( img->size.w, img->size.h,
-                                                      img->blob );
-    
-    // set current image
-    imlib_context_set_image( work );
-    work = imlib_create_cropped_scaled_image( 0, 0, img->size.w, img->size.h, 
-                                              img->resize.w, img->resize.h );
-    imlib_free_image_and_decache();
-    imlib_context_set_image( work );
-    save2path( img, path, &err );
-    // failed
-    if( err ){
-        liberr2errno( err );
-        lua_pushstring( L, strerror(errno) );
-        return 2;
-    }
-    // success
-    else {
-        lua_pushnil( L );
-    }
+    img_t tmpl;
+    img_run_item_t *item = NULL;
+    char where[64];
+    int i = 0;
+    int j = 0;
     
-    return 1;
+    // default export options of the specs
+    img_init( &tmpl, NULL, 0, 0 );
+    tmpl.format[0] = 0;
+    for(; i < r->nitem; i++ )
+    {
+        item = &r->items[i];
+        *item = (img_run_item_t){ .specs = specs };
+        lua_rawgeti( L, 1, i + 1 );
+        // source
+        lua_getfield( L, -1, "path" );
+        lua_getfield( L, -2, "data" );
+        lua_getfield( L, -3, "format" );
+        if( lua_type( L, -3 ) == LUA_TSTRING ){
+            item->path = lua_tostring( L, -3 );
+        }
+        else if( lua_type( L, -2 ) == LUA_TSTRING ){
+            item->data = lua_tolstring( L, -2, &item->len );
+        }
+        else {
+            luaL_error( L, "manifest[%d].path must be string", i + 1 );
+        }
+        if( !lua_isnil( L, -1 ) )
+        {
+            if( lua_type( L, -1 ) != LUA_TSTRING ){
+                luaL_error( L, "manifest[%d].format must be string", i + 1 );
+            }
+            item->format = lua_tostring( L, -1 );
+        }
+        lua_pop( L, 3 );
+        // load options
+        lua_getfield( L, -1, "opts" );
+        check_load_opts( L, lua_gettop( L ), &item->hint );
+        lua_pop( L, 1 );
+        // export specs
+        lua_getfield( L, -1, "specs" );
+        item->nspec = (int)lstate_rawlen( L, -1 );
+        for( j = 0; j < item->nspec; j++ ){
+            snprintf( where, sizeof( where ), "manifest[%d].specs[%d]", 
+                      i + 1, j + 1 );
+            lua_rawgeti( L, -1, j + 1 );
+            batch_checkspec( L, &tmpl, where, &specs[j].out, 0 );
+            // the threads use the specs after tmpl is gone, so the default 
+            // format (the format of the source) must not refer to it
+            if( specs[j].out.format == tmpl.format ){
+                specs[j].out.format = "";
+            }
+            specs[j].item = item;
+            specs[j].work = NULL;
+            specs[j].errnum = 0;
+            lua_pop( L, 1 );
+        }
+        item->pending = item->nspec;
+        specs += item->nspec;
+        lua_pop( L, 2 );
+    }
 }
 
 
-static int save_crop_lua( lua_State *L )
+// push the error of the item, or returns 0 if the item is succeeded
+static int run_pusherr( lua_State *L, img_run_item_t *item )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    const char *path = luaL_checkstring( L, 2 );
-    uint8_t align = IMG_ALIGN_NONE;
-    uint8_t halign = IMG_ALIGN_CENTER;
-    uint8_t valign = IMG_ALIGN_MIDDLE;
-    img_bounds_t bounds = (img_bounds_t){ 0, 0, 0, 0 };
-    double aspect_org = 0;
-    double aspect = 0;
-    Imlib_Image work = NULL;
-    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
-    
-    // check alignment arguments
-    // horizontal
-    if( !lua_isnoneornil( L, 3 ) )
-    {
-        halign = (uint8_t)luaL_checkint( L, 3 );
-        if( halign < IMG_ALIGN_LEFT || halign > IMG_ALIGN_RIGHT ){
-            return luaL_argerror( L, 3, "horizontal align must be LEFT, RIGHT or CENTER" );
-        }
+    int i = 0;
+    int nerr = 0;
+    
+    if( item->errnum ){
+        lua_pushstring( L, strerror( item->errnum ) );
+        return 1;
     }
-    // vertical
-    if( !lua_isnoneornil( L, 4 ) )
+    
+    for(; i < item->nspec; i++ )
     {
-        valign = (uint8_t)luaL_checkinteger( L, 4 );
-        if( valign < IMG_ALIGN_TOP || valign > IMG_ALIGN_BOTTOM ){
-            return luaL_argerror( L, 4, "vertical align must be TOP, BOTTOM or MIDDLE" );
+        if( item->specs[i].errnum ){
+            if( !nerr++ ){
+                lua_newtable( L );
+            }
+            lua_pushstring( L, strerror( item->specs[i].errnum ) );
+            lua_rawseti( L, -2, i + 1 );
         }
     }
     
-    // calculate bounds of cropped image by aspect ratio
-    aspect_org = (double)img->size.w/(double)img->size.h;
-    aspect = (double)img->resize.w/(double)img->resize.h;
-    // based on height
-    if( aspect_org > aspect ){
-        bounds.h = img->size.h;
-        bounds.w = (int)((double)img->size.h * aspect);
-        align = (uint8_t)halign;
-    }
-    // based on width
-    else if( aspect_org < aspect ){
-        bounds.w = img->size.w;
-        bounds.h = (int)((double)img->size.w / aspect);
-        align = (uint8_t)valign;
-    }
-    // square
-    else {
-        bounds.w = img->size.w;
-        bounds.h = img->size.h;
-    }
-    // calculate bounds position
-    BOUNDS_ALIGN( bounds, align, img->size );
-    
-    // create image
-    work = imlib_create_image_using_data( img->size.w, img->size.h, img->blob );
-    imlib_context_set_image( work );
-    work = imlib_create_cropped_scaled_image( bounds.x, bounds.y, bounds.w, 
-                                              bounds.h, img->resize.w, 
-                                              img->resize.h );
-    imlib_free_image_and_decache();
-    imlib_context_set_image( work );
-    save2path( img, path, &err );
+    return nerr > 0;
+}
+
+
+static int run_optint( lua_State *L, const char *k, int def )
+{
+    int v = def;
     
-    // failed
-    if( err ){
-        liberr2errno( err );
-        lua_pushstring( L, strerror(errno) );
-    }
-    // success
-    else {
-        lua_pushnil( L );
+    lua_getfield( L, 2, k );
+    if( !lua_isnil( L, -1 ) && 
+        ( !lua_isnumber( L, -1 ) || ( v = (int)lua_tointeger( L, -1 ) ) < 1 ) ){
+        luaL_argerror( L, 2, lua_pushfstring( L, "%s must be larger than 0", 
+                                              k ) );
     }
+    lua_pop( L, 1 );
     
-    return 1;
+    return v;
 }
 
 
-static int save_trim_lua( lua_State *L )
+// state of the pipeline that is kept in the userdata, so the threads never 
+// refer to the C stack of run_lua that may be unwound by the lua error
+typedef struct {
+    img_run_t r;
+    int started;
+} run_state_t;
+
+
+// stop the threads of the pipeline that is abandoned by the lua error
+static int run_gc( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    const char *path = luaL_checkstring( L, 2 );
-    img_bounds_t bounds = (img_bounds_t){ 0, 0, 0, 0 };
-    double aspect_org = 0;
-    double aspect = 0;
-    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
-    Imlib_Image work = NULL;
-    
-    // calculate bounds of image with maintaining aspect ratio.
-    aspect_org = (double)img->size.w/(double)img->size.h;
-    aspect = (double)img->resize.w/(double)img->resize.h;
-    // based on width
-    if( aspect_org > aspect ){
-        bounds.w = img->resize.w;
-        bounds.h = (int)((double)bounds.w / aspect_org);
-    }
-    // based on height
-    else if( aspect_org < aspect ){
-        bounds.h = img->resize.h;
-        bounds.w = (int)((double)bounds.h * aspect_org);
-    }
-    // square
-    else {
-        bounds.w = img->resize.w;
-        bounds.h = img->resize.h;
-    }
+    run_state_t *s = (run_state_t*)lua_touserdata( L, 1 );
     
-    // create image
-    work = imlib_create_image_using_data( img->size.w, img->size.h, img->blob );
-    // set current image
-    imlib_context_set_image( work );
-    work = imlib_create_cropped_scaled_image( 0, 0, img->size.w, img->size.h, 
-                                              bounds.w, bounds.h );
-    imlib_free_image_and_decache();
-    imlib_context_set_image( work );
-    save2path( img, path, &err );
-    
-    // failed
-    if( err ){
-        liberr2errno( err );
-        lua_pushstring( L, strerror(errno) );
-    }
-    // success
-    else {
-        lua_pushnil( L );
+    if( s->started ){
+        s->started = 0;
+        img_run_cancel( &s->r );
+        // the threads wait while the queue of the finished items is full
+        while( img_run_next( &s->r ) ){}
+        img_run_finish( &s->r );
     }
     
-    return 1;
+    return 0;
 }
 
 
-static int save_aspect_lua( lua_State *L )
+static int run_lua( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    const char *path = luaL_checkstring( L, 2 );
-    uint8_t align = IMG_ALIGN_NONE;
-    lua_Integer halign = IMG_ALIGN_CENTER;
-    lua_Integer valign = IMG_ALIGN_MIDDLE;
-    float hue = 0;
-    float saturation = 0;
-    float lightness = 0;
-    int alpha = 255;
-    img_bounds_t bounds = (img_bounds_t){ 0, 0, 0, 0 };
-    double aspect_org = 0;
-    double aspect = 0;
-    ImlibLoadError err = IMLIB_LOAD_ERROR_NONE;
-    Imlib_Image work = NULL;
-    Imlib_Image boundsImage = NULL;
-
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    int nthread[IMG_RUN_NSTAGE];
+    int depth = 0;
+    int nitem = 0;
+    int nspec = 0;
+    int total = 0;
+    int ndone = 0;
+    int nerr = 0;
+    int raised = 0;
+    int i = 0;
+    run_state_t *s = NULL;
+    img_run_t *r = NULL;
+    img_run_item_t *item = NULL;
     
-    // check arguments
-    // hue
-    if( !lua_isnoneornil( L, 3 ) ){
-        lua_Number arg = luaL_checknumber( L, 3 );
-        SETVAL_IN_RANGE( hue, float, arg, 0, 360 );
-    }
-    // saturation
-    if( !lua_isnoneornil( L, 4 ) ){
-        lua_Number arg = luaL_checknumber( L, 4 );
-        SETVAL_IN_RANGE( saturation, float, arg, 0, 1 );
-    }
-    // lightness
-    if( !lua_isnoneornil( L, 5 ) ){
-        lua_Number arg = luaL_checknumber( L, 5 );
-        SETVAL_IN_RANGE( lightness, float, arg, 0, 1 );
-    }
-    // alpha
-    if( !lua_isnoneornil( L, 6 ) ){
-        lua_Integer arg = luaL_checkinteger( L, 6 );
-        SETVAL_IN_RANGE( alpha, int, arg, 0, 255 );
-    }
-    // horizontal
-    if( !lua_isnoneornil( L, 7 ) )
-    {
-        halign = (uint8_t)luaL_checkint( L, 7 );
-        if( halign < IMG_ALIGN_LEFT || halign > IMG_ALIGN_RIGHT ){
-            return luaL_argerror( L, 7, "horizontal align must be LEFT, RIGHT or CENTER" );
-        }
+    ncpu = ncpu > 0 ? ncpu : 1;
+    luaL_checktype( L, 1, LUA_TTABLE );
+    if( lua_isnoneornil( L, 2 ) ){
+        lua_settop( L, 1 );
+        lua_newtable( L );
+    }
+    luaL_checktype( L, 2, LUA_TTABLE );
+    lua_settop( L, 2 );
+    
+    // options
+    nthread[IMG_RUN_DECODE] = run_optint( L, "decoders", (int)ncpu );
+    nthread[IMG_RUN_RENDER] = run_optint( L, "resizers", (int)ncpu );
+    nthread[IMG_RUN_ENCODE] = run_optint( L, "encoders", (int)ncpu );
+    depth = run_optint( L, "queue_depth", (int)ncpu * 2 );
+    lua_getfield( L, 2, "progress" );
+    if( !lua_isnil( L, -1 ) ){
+        luaL_checktype( L, -1, LUA_TFUNCTION );
     }
-    // vertical
-    if( !lua_isnoneornil( L, 8 ) )
+    
+    // count the specs of the manifest
+    nitem = (int)lstate_rawlen( L, 1 );
+    for( i = 1; i <= nitem; i++ )
     {
-        valign = (uint8_t)luaL_checkinteger( L, 8 );
-        if( valign < IMG_ALIGN_TOP || valign > IMG_ALIGN_BOTTOM ){
-            return luaL_argerror( L, 4, "vertical align must be TOP, BOTTOM or MIDDLE" );
+        lua_rawgeti( L, 1, i );
+        if( !lua_istable( L, -1 ) ){
+            luaL_error( L, "manifest[%d] must be table", i );
         }
+        lua_getfield( L, -1, "specs" );
+        if( !lua_isnil( L, -1 ) && !lua_istable( L, -1 ) ){
+            luaL_error( L, "manifest[%d].specs must be table", i );
+        }
+        nspec += lua_istable( L, -1 ) ? (int)lstate_rawlen( L, -1 ) : 0;
+        lua_pop( L, 2 );
     }
     
+    total = nthread[IMG_RUN_DECODE] + nthread[IMG_RUN_RENDER] + 
+            nthread[IMG_RUN_ENCODE];
+    s = (run_state_t*)lua_newuserdata( L, sizeof( run_state_t ) + 
+                sizeof( img_run_item_t ) * (size_t)nitem + 
+                sizeof( img_run_spec_t ) * (size_t)nspec + 
+                sizeof( pthread_t ) * (size_t)total );
+    s->started = 0;
+    r = &s->r;
+    *r = (img_run_t){ .nitem = nitem };
+    r->items = (img_run_item_t*)( s + 1 );
+    r->threads = (pthread_t*)( (img_run_spec_t*)( r->items + nitem ) + 
+                               nspec );
+    luaL_getmetatable( L, RUN_MT );
+    lua_setmetatable( L, -2 );
+    // keep the strings of the manifest while the threads refer to them
+    lua_createtable( L, 1, 0 );
+    lua_pushvalue( L, 1 );
+    lua_rawseti( L, -2, 1 );
+    lstate_setuservalue( L, -2 );
+    run_checkitems( L, r, (img_run_spec_t*)( r->items + nitem ) );
+    // table of errors
+    lua_newtable( L );
     
-    // calculate bounds of image with maintaining aspect ratio
-    aspect_org = (double)img->size.w/(double)img->size.h;
-    aspect = (double)img->resize.w/(double)img->resize.h;
-    // based on width
-    if( aspect_org > aspect ){
-        bounds.w = img->resize.w;
-        bounds.h = (int)((double)bounds.w / aspect_org);
-        align = (uint8_t)valign;
+    if( img_run_start( r, nthread, depth ) != 0 ){
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( errno ) );
+        return 2;
     }
-    // based on height
-    else if( aspect_org < aspect ){
-        bounds.h = img->resize.h;
-        bounds.w = (int)((double)bounds.h * aspect_org);
-        align = (uint8_t)halign;
+    s->started = 1;
+    
+    // report the finished items
+    while( ( item = img_run_next( r ) ) )
+    {
+        i = (int)( item - r->items ) + 1;
+        ndone++;
+        if( !run_pusherr( L, item ) ){
+            lua_pushnil( L );
+        }
+        else {
+            nerr++;
+            lua_pushvalue( L, -1 );
+            lua_rawseti( L, 5, i );
+        }
+        if( !r->errnum && !raised && !lua_isnil( L, 3 ) )
+        {
+            lua_pushvalue( L, 3 );
+            lua_insert( L, -2 );
+            lua_pushinteger( L, i );
+            lua_insert( L, -2 );
+            lua_pushinteger( L, ndone );
+            lua_pushinteger( L, r->nitem );
+            // stop the pipeline and raise the error after the threads
+            if( lua_pcall( L, 4, 0, 0 ) != 0 ){
+                raised = 1;
+                img_run_cancel( r );
+                lua_replace( L, 3 );
+            }
+        }
+        else {
+            lua_pop( L, 1 );
+        }
     }
-    // square
-    else {
-        bounds.w = img->resize.w;
-        bounds.h = img->resize.h;
-    }
-    // calculate bounds position
-    BOUNDS_ALIGN( bounds, align, img->resize );
-    
-    // create image
-    work = imlib_create_image_using_data( img->size.w, img->size.h, img->blob );
-    // set current image
-    imlib_context_set_image( work );
-    work = imlib_create_cropped_scaled_image( 0, 0, img->size.w, img->size.h, 
-                                              bounds.w, bounds.h );
-    imlib_free_image_and_decache();
-    boundsImage = imlib_create_image( img->resize.w, img->resize.h );
-    imlib_context_set_image( boundsImage );
-    imlib_context_set_color_hlsa( hue, lightness, saturation, alpha );
-    imlib_image_fill_rectangle( 0, 0, img->resize.w, img->resize.h );
-    imlib_blend_image_onto_image( work, 0, 0, 0, bounds.w, bounds.h, bounds.x, 
-                                  bounds.y, bounds.w, bounds.h );
-    imlib_context_set_image( work );
-    imlib_free_image_and_decache();
-    imlib_context_set_image( boundsImage );
-    save2path( img, path, &err );
+    img_run_finish( r );
+    s->started = 0;
     
-    // failed
-    if( err ){
-        liberr2errno( err );
-        lua_pushstring( L, strerror(errno) );
+    if( raised ){
+        lua_settop( L, 3 );
+        return lua_error( L );
     }
-    // success
-    else {
+    else if( r->errnum ){
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( r->errnum ) );
+        return 2;
+    }
+    else if( !nerr ){
         lua_pushnil( L );
     }
     
@@ -501,207 +1858,188 @@ static int save_aspect_lua( lua_State *L )
 }
 
 
-static int raw_lua( lua_State *L )
+// MARK: probe
+static int probe_result( lua_State *L, int rc, probe_info_t *info )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    
-    if( img->blob ){
-        lua_pushlightuserdata( L, img->blob );
-        lua_pushinteger( L, (lua_Integer)img->bytes );
+    if( rc != 0 ){
+        lua_pushnil( L );
+        lua_pushstring( L, strerror( errno ) );
         return 2;
     }
     
-    lua_pushnil( L );
+    lua_createtable( L, 0, 5 );
+    lstate_str2tbl( L, "format", info->format );
+    lstate_num2tbl( L, "width", info->w );
+    lstate_num2tbl( L, "height", info->h );
+    lua_pushstring( L, "alpha" );
+    lua_pushboolean( L, info->alpha );
+    lua_rawset( L, -3 );
+    lstate_num2tbl( L, "orientation", info->orientation );
     
     return 1;
 }
 
 
-static int rawsize_lua( lua_State *L )
-{
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    
-    lua_pushinteger( L, img->size.w );
-    lua_pushinteger( L, img->size.h );
-    
-    return 2;
-}
-
-
-static int size_lua( lua_State *L )
+static int probe_lua( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    const char *path = luaL_checkstring( L, 1 );
+    probe_info_t info;
+    int fd = open( path, O_RDONLY|O_CLOEXEC );
+    int rc = -1;
     
-    if( !lua_isnoneornil( L, 2 ) )
-    {
-        int width = luaL_checkint( L, 2 );
-        int height = luaL_checkint( L, 3 );
-        
-        if( width < 0 ){
-            luaL_argerror( L, 2, "width must be larger than 0" );
-        }
-        else if( height < 0 ){
-            luaL_argerror( L, 3, "height must be larger than 0" );
-        }
-        
-        img->resize.w = width;
-        img->resize.h = height;
+    if( fd != -1 ){
+        rc = probe_fd( &info, fd );
+        close( fd );
     }
     
-    lua_pushinteger( L, img->resize.w );
-    lua_pushinteger( L, img->resize.h );
-    
-    return 2;
+    return probe_result( L, rc, &info );
 }
 
 
-static int quality_lua( lua_State *L )
+static int probe_buffer_lua( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    
-    if( !lua_isnoneornil( L, 2 ) ){
-        int quality = luaL_checkint( L, 2 );
-        SETVAL_IN_RANGE( img->quality, uint8_t, quality, 0, 100 );
-    }
-    
-    lua_pushinteger( L, img->quality );
+    size_t len = 0;
+    const char *data = luaL_checklstring( L, 1, &len );
+    probe_info_t info;
     
-    return 1;
+    return probe_result( L, probe_mem( &info, data, len ), &info );
 }
 
 
-static int format_lua( lua_State *L )
+static int limits_lua( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
+    img_limits_t lim;
     
-    if( !lua_isnoneornil( L, 2 ) )
+    img_limits_get( &lim );
+    // update limits
+    if( !lua_isnoneornil( L, 1 ) )
     {
-        size_t len = 0;
-        const char *format = luaL_checklstring( L, 2, &len );
-        
-        // allocation error
-        if( img_format_copy( img, format, len ) == -1 ){
-            lua_pushnil( L );
-            lua_pushstring( L, strerror( errno ) );
-            return 2;
+        luaL_checktype( L, 1, LUA_TTABLE );
+        lua_getfield( L, 1, "pixels" );
+        if( !lua_isnil( L, -1 ) ){
+            lua_Number n = luaL_checknumber( L, -1 );
+            
+            luaL_argcheck( L, n >= 0, 1, "pixels must be larger than -1" );
+            lim.pixels = (size_t)n;
+        }
+        lua_getfield( L, 1, "bytes" );
+        if( !lua_isnil( L, -1 ) ){
+            lua_Number n = luaL_checknumber( L, -1 );
+            
+            luaL_argcheck( L, n >= 0, 1, "bytes must be larger than -1" );
+            lim.bytes = (size_t)n;
         }
+        lua_pop( L, 2 );
+        img_limits_set( lim.pixels, lim.bytes );
     }
     
-    lua_pushinteger( L, img->quality );
+    lua_createtable( L, 0, 3 );
+    lstate_num2tbl( L, "pixels", lim.pixels );
+    lstate_num2tbl( L, "bytes", lim.bytes );
+    lstate_num2tbl( L, "live", lim.live );
     
     return 1;
 }
 
 
-static int free_lua( lua_State *L )
+static int threads_lua( lua_State *L )
 {
-    img_t *img = (img_t*)luaL_checkudata( L, 1, MODULE_MT );
-    
-    if( img->blob ){
-        free( img->blob );
-        img->blob = NULL;
+    if( !lua_isnoneornil( L, 1 ) ){
+        int n = luaL_checkint( L, 1 );
+        
+        luaL_argcheck( L, n > 0 && n <= BAND_MAX_THREADS, 1, 
+                       "nthreads must be range of 1 to 64" );
+        img_threads( n );
     }
     
-    return 0;
-}
-
-
-static int dealloc_gc( lua_State *L )
-{
-    img_t *img = (img_t*)lua_touserdata( L, 1 );
-    
-    if( img->blob ){
-        free( img->blob );
-    }
+    lua_pushinteger( L, img_threads( 0 ) );
     
-    return 0;
-}
-
-
-static int tostring_lua( lua_State *L )
-{
-    lua_pushfstring( L, MODULE_MT ": %p", lua_touserdata( L, 1 ) );
     return 1;
 }
 
 
-static int load_lua( lua_State *L )
+// MARK: stats
+static void push_timer( lua_State *L, stats_timer_t *t )
 {
-    const char *path = luaL_checkstring( L, 1 );
-    img_t *img = (img_t*)lua_newuserdata( L, sizeof( img_t ) );
+    int i = 0;
     
-    if( img && img_load( img, path ) == 0 ){
-        // set metatable
-        luaL_getmetatable( L, MODULE_MT );
-        lua_setmetatable( L, -2 );
-        return 1;
+    lstate_num2tbl( L, "count", t->count );
+    lstate_num2tbl( L, "ns", t->ns );
+    lstate_num2tbl( L, "max_ns", t->max_ns );
+    lua_pushstring( L, "hist" );
+    lua_createtable( L, STATS_NBUCKET, 0 );
+    for(; i < STATS_NBUCKET; i++ ){
+        lua_pushnumber( L, t->hist[i] );
+        lua_rawseti( L, -2, i + 1 );
     }
-    
-    // got error
-    lua_pushnil( L );
-    lua_pushstring( L, strerror( errno ) );
-    
-    return 2;
+    lua_rawset( L, -3 );
 }
 
 
-static int read_lua( lua_State *L )
+static int stats_lua( lua_State *L )
 {
-    int w = luaL_checkint( L, 1 );
-    int h = luaL_checkint( L, 2 );
-    const void *ptr = NULL;
-    img_t *img = NULL;
+    int reset = lua_toboolean( L, 1 );
+    stats_t *stats = (stats_t*)lua_newuserdata( L, sizeof( stats_t ) );
+    int i, j;
     
-    // check arguments
-    if( w < 1 ){
-        return luaL_argerror( L, 1, "width must be larger than 0" );
-    }
-    else if( h < 1 ){
-        return luaL_argerror( L, 2, "height must be larger than 0" );
-    }
-    else if( !lua_islightuserdata( L, 3 ) ){
-        return luaL_argerror( L, 3, "data must be type of lightuserdata" );
+    stats_snapshot( stats, reset );
+    lua_createtable( L, 0, 3 );
+    
+    // stages
+    lua_pushstring( L, "stages" );
+    lua_createtable( L, 0, STATS_NSTAGE );
+    for( i = 0; i < STATS_NSTAGE; i++ ){
+        lua_pushstring( L, stats_stage_name( i ) );
+        lua_createtable( L, 0, 4 );
+        push_timer( L, &stats->stages[i] );
+        lua_rawset( L, -3 );
     }
-    ptr = lua_topointer( L, 3 );
+    lua_rawset( L, -3 );
     
-    if( ( img = (img_t*)lua_newuserdata( L, sizeof( img_t ) ) ) )
+    // operations by format
+    lua_pushstring( L, "ops" );
+    lua_createtable( L, 0, STATS_NOP );
+    for( i = 0; i < STATS_NOP; i++ )
     {
-        img->size = (img_size_t){ w, h };
-        img->bytes = sizeof( DATA32 ) * (size_t)w * (size_t)h;
-        img->blob = malloc( img->bytes );
-        if( img->blob )
-        {
-            // use default file format
-            if( img_format_copy( img, DEFAULT_FORMAT, sizeof( DEFAULT_FORMAT ) ) == 0 ){
-                memcpy( img->blob, ptr, img->bytes );
-                img->quality = 100;
-                img->resize = (img_size_t){ 0, 0 };
-                // set metatable
-                luaL_getmetatable( L, MODULE_MT );
-                lua_setmetatable( L, -2 );
-                return 1;
-            }
+        lua_pushstring( L, stats_op_name( i ) );
+        lua_newtable( L );
+        for( j = 0; j < STATS_NFORMAT && stats->ops[i][j].name[0]; j++ ){
+            stats_format_t *fmt = &stats->ops[i][j];
             
-            free( img->blob );
+            lua_pushstring( L, fmt->name );
+            lua_createtable( L, 0, 7 );
+            lstate_num2tbl( L, "errors", fmt->errors );
+            lstate_num2tbl( L, "bytes_in", fmt->bytes_in );
+            lstate_num2tbl( L, "bytes_out", fmt->bytes_out );
+            push_timer( L, &fmt->timer );
+            lua_rawset( L, -3 );
         }
+        lua_rawset( L, -3 );
     }
+    lua_rawset( L, -3 );
     
-    // got error
-    lua_pushnil( L );
-    lua_pushstring( L, strerror( errno ) );
+    // errors by errno
+    lua_pushstring( L, "errors" );
+    lua_newtable( L );
+    for( i = 1; i <= STATS_MAX_ERRNO; i++ ){
+        if( stats->errnos[i] ){
+            lstate_num2tbl( L, strerror( i ), stats->errnos[i] );
+        }
+    }
+    lua_rawset( L, -3 );
     
-    return 2;
+    return 1;
 }
 
 
 // module definition register
-static void define_mt( lua_State *L, struct luaL_Reg mmethod[], 
-                       struct luaL_Reg method[] )
+static void define_mt( lua_State *L, const char *tname, 
+                       struct luaL_Reg mmethod[], struct luaL_Reg method[] )
 {
     int i = 0;
     
     // create table __metatable
-    luaL_newmetatable( L, MODULE_MT );
+    luaL_newmetatable( L, tname );
     // metamethods
     while( mmethod[i].name ){
         lstate_fn2tbl( L, mmethod[i].name, mmethod[i].func );
@@ -732,21 +2070,64 @@ LUALIB_API int luaopen_thumbnailer( lua_State *L )
         { "free", free_lua },
         { "raw", raw_lua },
         { "rawsize", rawsize_lua },
+        { "origsize", origsize_lua },
+        { "fingerprint", fingerprint_lua },
         { "size", size_lua },
         { "quality", quality_lua },
+        { "filter", filter_lua },
         { "format", format_lua },
         { "save", save_lua },
         { "saveCrop", save_crop_lua },
         { "saveTrim", save_trim_lua },
         { "saveAspect", save_aspect_lua },
+        { "saveBatch", save_batch_lua },
+        { "encode", encode_lua },
+        { "encodeCrop", encode_crop_lua },
+        { "encodeTrim", encode_trim_lua },
+        { "encodeAspect", encode_aspect_lua },
+        { NULL, NULL }
+    };
+    
+    struct luaL_Reg pool_mmethod[] = {
+        { "__gc", pool_gc },
+        { "__tostring", pool_tostring_lua },
+        { NULL, NULL }
+    };
+    struct luaL_Reg pool_method[] = {
+        { "submit", pool_submit_lua },
+        { "fd", pool_fd_lua },
+        { "collect", pool_collect_lua },
+        { "close", pool_gc },
+        { NULL, NULL }
+    };
+    
+    struct luaL_Reg run_mmethod[] = {
+        { "__gc", run_gc },
+        { NULL, NULL }
+    };
+    struct luaL_Reg run_method[] = {
         { NULL, NULL }
     };
     
-    define_mt( L, mmethod, method );
+    define_mt( L, MODULE_MT, mmethod, method );
+    define_mt( L, POOL_MT, pool_mmethod, pool_method );
+    define_mt( L, RUN_MT, run_mmethod, run_method );
     // method
     lua_newtable( L );
     lstate_fn2tbl( L, "load", load_lua );
+    lstate_fn2tbl( L, "loadBuffer", load_buffer_lua );
     lstate_fn2tbl( L, "read", read_lua );
+    lstate_fn2tbl( L, "pool", pool_lua );
+    lstate_fn2tbl( L, "run", run_lua );
+    lstate_fn2tbl( L, "atlas", atlas_lua );
+    lstate_fn2tbl( L, "probe", probe_lua );
+    lstate_fn2tbl( L, "probeBuffer", probe_buffer_lua );
+    lstate_fn2tbl( L, "limits", limits_lua );
+    lstate_fn2tbl( L, "threads", threads_lua );
+    lstate_fn2tbl( L, "stats", stats_lua );
+    lstate_fn2tbl( L, "cache", cache_lua );
+    lstate_fn2tbl( L, "outputCache", output_cache_lua );
+    lstate_fn2tbl( L, "bufferPool", buffer_pool_lua );
     // constants
     // alignments
     lstate_num2tbl( L, "LEFT", IMG_ALIGN_LEFT );
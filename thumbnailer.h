@@ -0,0 +1,111 @@
+/*
+ *  Copyright (C) 2014 Masatoshi Teruya
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *
+ *  thumbnailer.h
+ *  lua-thumbnailer
+ *
+ *  stable C ABI of the thumbnailer core for the FFI bindings.
+ *  thumbnailer/ffi.lua declares the same functions.
+ *
+ */
+
+#ifndef ___THUMBNAILER_H___
+#define ___THUMBNAILER_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// opaque image handle
+typedef struct img_s thumbnailer_t;
+
+// export modes
+enum {
+    THUMBNAILER_STRETCH = 0,
+    THUMBNAILER_CROP,
+    THUMBNAILER_TRIM,
+    THUMBNAILER_ASPECT
+};
+
+// alignments of crop and aspect modes
+enum {
+    THUMBNAILER_LEFT = 1,
+    THUMBNAILER_CENTER,
+    THUMBNAILER_RIGHT,
+    THUMBNAILER_TOP,
+    THUMBNAILER_MIDDLE,
+    THUMBNAILER_BOTTOM
+};
+
+
+// the following functions return 0 on success, or the error number on 
+// failure. the functions that create the image return NULL on failure and 
+// set the error number to err.
+
+// create the image from the image file. hint_w and hint_h are the minimum 
+// size of the decoded image, or 0 to decode at full size.
+thumbnailer_t *thumbnailer_load( const char *path, int hint_w, int hint_h, 
+                                 int *err );
+// create the image from the encoded image data. format is used if the 
+// format could not be detected from data, or NULL.
+thumbnailer_t *thumbnailer_load_buffer( const void *data, size_t len, 
+                                        const char *format, int hint_w, 
+                                        int hint_h, int *err );
+// create the image from the raw pixels of the pixel format name; argb32, 
+// bgra, rgba, rgb24 or bgr24. stride is the bytes of a row, or 0.
+thumbnailer_t *thumbnailer_read( int w, int h, const void *data, 
+                                 size_t stride, const char *pixfmt, 
+                                 int *err );
+void thumbnailer_free( thumbnailer_t *img );
+
+// returns the 32-bit ARGB pixels in native byte order of w x h without 
+// the row padding. the pixels are valid until the image is freed, and 
+// must not be modified.
+const uint32_t *thumbnailer_pixels( thumbnailer_t *img, int *w, int *h );
+// size of the source image before scaled decoding
+void thumbnailer_origsize( thumbnailer_t *img, int *w, int *h );
+
+// export options
+int thumbnailer_resize( thumbnailer_t *img, int w, int h );
+int thumbnailer_quality( thumbnailer_t *img, int quality );
+// imlib, box, bilinear, bicubic or lanczos
+int thumbnailer_filter( thumbnailer_t *img, const char *name );
+int thumbnailer_format( thumbnailer_t *img, const char *format );
+
+// render the image by mode and alignments, and save it to path. 0 of 
+// alignment is the center and middle.
+int thumbnailer_save( thumbnailer_t *img, const char *path, int mode, 
+                      int halign, int valign );
+// render the image and return the encoded image that must be released by 
+// thumbnailer_release.
+int thumbnailer_encode( thumbnailer_t *img, int mode, int halign, 
+                        int valign, void **data, size_t *len );
+void thumbnailer_release( void *data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
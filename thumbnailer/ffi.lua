@@ -0,0 +1,167 @@
+--[[
+  
+  thumbnailer.ffi
+  lua-thumbnailer
+  
+  LuaJIT FFI binding of the stable C ABI declared in thumbnailer.h.
+  
+--]]
+local ffi = require('ffi');
+
+ffi.cdef[[
+typedef struct img_s thumbnailer_t;
+
+thumbnailer_t *thumbnailer_load( const char *path, int hint_w, int hint_h, 
+                                 int *err );
+thumbnailer_t *thumbnailer_load_buffer( const void *data, size_t len, 
+                                        const char *format, int hint_w, 
+                                        int hint_h, int *err );
+thumbnailer_t *thumbnailer_read( int w, int h, const void *data, 
+                                 size_t stride, const char *pixfmt, 
+                                 int *err );
+void thumbnailer_free( thumbnailer_t *img );
+const uint32_t *thumbnailer_pixels( thumbnailer_t *img, int *w, int *h );
+void thumbnailer_origsize( thumbnailer_t *img, int *w, int *h );
+int thumbnailer_resize( thumbnailer_t *img, int w, int h );
+int thumbnailer_quality( thumbnailer_t *img, int quality );
+int thumbnailer_filter( thumbnailer_t *img, const char *name );
+int thumbnailer_format( thumbnailer_t *img, const char *format );
+int thumbnailer_save( thumbnailer_t *img, const char *path, int mode, 
+                      int halign, int valign );
+int thumbnailer_encode( thumbnailer_t *img, int mode, int halign, 
+                        int valign, void **data, size_t *len );
+void thumbnailer_release( void *data );
+char *strerror( int errnum );
+]]
+
+-- the C ABI is exported by the thumbnailer module library
+local lib = ffi.load( package.searchpath( 'thumbnailer', package.cpath ) );
+local MODES = {
+    stretch = 0,
+    crop = 1,
+    trim = 2,
+    aspect = 3
+};
+
+local function strerror( err )
+    return ffi.string( ffi.C.strerror( err ) );
+end
+
+local function check( err )
+    if err ~= 0 then
+        return false, strerror( err );
+    end
+    return true;
+end
+
+
+local Image = {};
+Image.__index = Image;
+
+local function newImage( img, err )
+    if img == nil then
+        return nil, strerror( err[0] );
+    end
+    return setmetatable( {
+        img = ffi.gc( img, lib.thumbnailer_free )
+    }, Image );
+end
+
+function Image:free()
+    if self.img then
+        lib.thumbnailer_free( ffi.gc( self.img, nil ) );
+        self.img = nil;
+    end
+end
+
+-- returns the uint32_t pointer to the ARGB pixels, width and height.
+-- the pointer is valid while the image is alive.
+function Image:pixels()
+    local w, h = ffi.new('int[1]'), ffi.new('int[1]');
+    local pixels = lib.thumbnailer_pixels( self.img, w, h );
+    
+    return pixels, w[0], h[0];
+end
+
+function Image:origSize()
+    local w, h = ffi.new('int[1]'), ffi.new('int[1]');
+    
+    lib.thumbnailer_origsize( self.img, w, h );
+    return w[0], h[0];
+end
+
+function Image:size( w, h )
+    return check( lib.thumbnailer_resize( self.img, w or 0, h or 0 ) );
+end
+
+function Image:quality( quality )
+    return check( lib.thumbnailer_quality( self.img, quality ) );
+end
+
+function Image:filter( name )
+    return check( lib.thumbnailer_filter( self.img, name ) );
+end
+
+function Image:format( format )
+    return check( lib.thumbnailer_format( self.img, format ) );
+end
+
+-- mode: 'stretch', 'crop', 'trim' or 'aspect'
+function Image:save( path, mode, halign, valign )
+    return check( lib.thumbnailer_save( self.img, path, 
+                                        MODES[mode or 'stretch'] or -1, 
+                                        halign or 0, valign or 0 ) );
+end
+
+function Image:encode( mode, halign, valign )
+    local data, len = ffi.new('void*[1]'), ffi.new('size_t[1]');
+    local err = lib.thumbnailer_encode( self.img, 
+                                        MODES[mode or 'stretch'] or -1, 
+                                        halign or 0, valign or 0, data, len );
+    local blob;
+    
+    if err ~= 0 then
+        return nil, strerror( err );
+    end
+    blob = ffi.string( data[0], len[0] );
+    lib.thumbnailer_release( data[0] );
+    
+    return blob;
+end
+
+
+local function load( path, hintW, hintH )
+    local err = ffi.new('int[1]');
+    
+    return newImage( lib.thumbnailer_load( path, hintW or 0, hintH or 0, err ), 
+                     err );
+end
+
+local function loadBuffer( data, format, hintW, hintH )
+    local err = ffi.new('int[1]');
+    
+    return newImage( lib.thumbnailer_load_buffer( data, #data, format, 
+                                                  hintW or 0, hintH or 0, 
+                                                  err ), err );
+end
+
+-- data is a string or a pointer to the raw pixels
+local function read( w, h, data, pixfmt, stride )
+    local err = ffi.new('int[1]');
+    
+    return newImage( lib.thumbnailer_read( w, h, data, stride or 0, 
+                                           pixfmt or 'argb32', err ), err );
+end
+
+
+return {
+    load = load,
+    loadBuffer = loadBuffer,
+    read = read,
+    LEFT = 1,
+    CENTER = 2,
+    RIGHT = 3,
+    TOP = 4,
+    MIDDLE = 5,
+    BOTTOM = 6
+};